@@ -460,7 +460,7 @@ int gen_create (struct tl_tree *t, int *vars, int offset) {
   }
 }
 
-int gen_field_skip (struct arg *arg, int *vars, int num) {
+int gen_field_skip (struct arg *arg, int *vars, int num, int view) {
   assert (arg);
   char *offset = "  ";
   int o = 0;
@@ -469,6 +469,9 @@ int gen_field_skip (struct arg *arg, int *vars, int num) {
     offset = "    ";
     o = 2;
   }
+  if (view) {
+    printf ("%sfields[%d] = in->ptr;\n", offset, num - 1);
+  }
   if (arg->var_num >= 0) {
     assert (TL_TREE_METHODS (arg->type)->type (arg->type) == NODE_TYPE_TYPE);
     int t = ((struct tl_tree_type *)arg->type)->type->name;
@@ -792,7 +795,7 @@ int gen_field_autocomplete (struct arg *arg, int *vars, int num, int from_func,
   return 0;
 }
 
-int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
+int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty, unsigned name) {
   assert (arg);
   char *offset = "  ";
   int o = 0;
@@ -809,12 +812,12 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       assert (0);
     } else {
       assert (t == NAME_VAR_NUM);
-      printf ("%sassert (in_remaining (in) >= 4);\n", offset);
+      printf ("%sif (in_remaining (in) < 4) { fetch_fail (in, 0x%08x); return NULL; }\n", offset, name);
       if (arg->id && strlen (arg->id)) {
-        printf ("%sresult->%s = (decltype(result->%s))malloc (4);", offset, arg->id, arg->id);
+        printf ("%sresult->%s = (decltype(result->%s))tl_ds_alloc (arena, 4);", offset, arg->id, arg->id);
         printf ("%s*result->%s = prefetch_i32 (in);", offset, arg->id);
       } else {
-        printf ("%sresult->f%d = (decltype(result->f%d))malloc (4);", offset, num - 1, num - 1);
+        printf ("%sresult->f%d = (decltype(result->f%d))tl_ds_alloc (arena, 4);", offset, num - 1, num - 1);
         printf ("%s*result->f%d = prefetch_i32 (in);", offset, num - 1);
       }
       if (vars[arg->var_num] == 0) {
@@ -852,9 +855,14 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
         }
       }
       if (!bare) {
-        printf ("fetch_ds_type_%s (in, &field%d);\n", t == NODE_TYPE_VAR_TYPE ? "any" : ((struct tl_tree_type *)arg->type)->type->print_id, num);
+        printf ("fetch_ds_type_%s (in, &field%d, arena);\n", t == NODE_TYPE_VAR_TYPE ? "any" : ((struct tl_tree_type *)arg->type)->type->print_id, num);
+      } else {
+        printf ("fetch_ds_type_bare_%s (in, &field%d, arena);\n", t == NODE_TYPE_VAR_TYPE ? "any" : ((struct tl_tree_type *)arg->type)->type->print_id, num);
+      }
+      if (arg->id && strlen (arg->id)) {
+        printf ("%sif (!result->%s) { fetch_fail (in, 0x%08x); return NULL; }\n", offset, arg->id, name);
       } else {
-        printf ("fetch_ds_type_bare_%s (in, &field%d);\n", t == NODE_TYPE_VAR_TYPE ? "any" : ((struct tl_tree_type *)arg->type)->type->print_id, num);
+        printf ("%sif (!result->f%d) { fetch_fail (in, 0x%08x); return NULL; }\n", offset, num - 1, name);
       }
     } else {
       assert (t == NODE_TYPE_ARRAY);
@@ -863,6 +871,9 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       (void)result;
       assert(result >= 0);
       printf ("%s);\n", offset);
+      // Every element takes at least one int, so this also keeps a corrupt
+      // multiplicity from turning into a huge allocation.
+      printf ("%sif (multiplicity%d < 0 || multiplicity%d > in_remaining (in) / 4) { fetch_fail (in, 0x%08x); return NULL; }\n", offset, num, num, name);
       printf ("%sconst struct paramed_type &field%d = \n", offset, num);
       result = gen_create (((struct tl_tree_array *)arg->type)->args[0]->type, vars, 2 + o);
       assert(result >= 0);
@@ -872,7 +883,7 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       } else {
         printf ("%sresult->f%d = (decltype(result->f%d))", offset, num - 1, num - 1);
       }
-      printf ("calloc (1, multiplicity%d * sizeof (void *));\n", num);
+      printf ("tl_ds_alloc (arena, multiplicity%d * sizeof (void *));\n", num);
       printf ("%s{\n", offset);
       printf ("%s  int i = 0;\n", offset);
       printf ("%s  while (i < multiplicity%d) {\n", offset, num);
@@ -881,7 +892,12 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       } else {
         printf ("%s    result->f%d[i ++] = ", offset, num - 1);
       }
-      printf ("fetch_ds_type_%s (in, &field%d);\n", "any", num);
+      printf ("fetch_ds_type_%s (in, &field%d, arena);\n", "any", num);
+      if (arg->id && strlen (arg->id)) {
+        printf ("%s    if (!result->%s[i - 1]) { fetch_fail (in, 0x%08x); return NULL; }\n", offset, arg->id, name);
+      } else {
+        printf ("%s    if (!result->f%d[i - 1]) { fetch_fail (in, 0x%08x); return NULL; }\n", offset, num - 1, name);
+      }
       printf ("%s  }\n", offset);
       printf ("%s}\n", offset);
     }
@@ -1123,8 +1139,12 @@ int gen_field_store_excl (struct arg *arg, int *vars, int num, int from_func) {
   return 0;
 }
 
-void gen_constructor_skip (struct tl_combinator *c) {
-  printf ("int skip_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", c->print_id);
+void gen_constructor_skip (struct tl_combinator *c, int view) {
+  if (view) {
+    printf ("int view_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields) {\n", c->print_id);
+  } else {
+    printf ("int skip_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", c->print_id);
+  }
   int i;
   for (i = 0; i < c->args_num; i++) if (c->args[i]->flags & FLAG_EXCL) {
     printf (" return -1;\n");
@@ -1165,7 +1185,7 @@ void gen_constructor_skip (struct tl_combinator *c) {
   }
 
   for (i = 0; i < c->args_num; i++) if (!(c->args[i]->flags & FLAG_OPT_VAR)) {
-    int result = gen_field_skip (c->args[i], vars, i + 1);
+    int result = gen_field_skip (c->args[i], vars, i + 1, view);
     (void)result;
     assert(result >= 0);
   }
@@ -1372,10 +1392,11 @@ void gen_constructor_autocomplete (struct tl_combinator *c) {
 
 void gen_constructor_fetch_ds (struct tl_combinator *c) {
   print_c_type_name (c->result, "", 0);
-  printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", c->print_id);
+  printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena) {\n", c->print_id);
   int i;
   for (i = 0; i < c->args_num; i++) if (c->args[i]->flags & FLAG_EXCL) {
-    printf (" assert (0);\n");
+    printf ("  fetch_fail (in, 0x%08x);\n", c->name);
+    printf ("  return NULL;\n");
     printf ("}\n");
     return;
   }
@@ -1385,9 +1406,20 @@ void gen_constructor_fetch_ds (struct tl_combinator *c) {
   int *vars = malloc0 (c->var_num * 4);;
   gen_uni_skip (c->result, s, vars, 1, 1);
 
+  // Check the input before allocating so that a malformed answer fails
+  // cleanly instead of asserting.
+  if (c->name == NAME_INT) {
+    printf ("  if (in_remaining (in) < 4) { fetch_fail (in, 0x%08x); return NULL; }\n", c->name);
+  } else if (c->name == NAME_LONG || c->name == NAME_DOUBLE) {
+    printf ("  if (in_remaining (in) < 8) { fetch_fail (in, 0x%08x); return NULL; }\n", c->name);
+  } else if (c->name == NAME_STRING || c->name == NAME_BYTES) {
+    printf ("  ssize_t l = prefetch_strlen (in);\n");
+    printf ("  if (l < 0) { fetch_fail (in, 0x%08x); return NULL; }\n", c->name);
+  }
+
   printf ("  ");
   print_c_type_name (c->result, "  ", 0);
-  printf ("  result = (decltype(result))calloc (1, sizeof (*result));\n");
+  printf ("  result = (decltype(result))tl_ds_alloc (arena, sizeof (*result));\n");
 
   struct tl_type *T = ((struct tl_tree_type *)c->result)->type;
   if (T->constructors_num > 1) {
@@ -1395,30 +1427,24 @@ void gen_constructor_fetch_ds (struct tl_combinator *c) {
   }
 
   if (c->name == NAME_INT) {
-    printf ("  assert (in_remaining (in) >= 4);\n");
     printf ("  *result = fetch_i32 (in);\n");
     printf ("  return result;\n");
     printf ("}\n");
     return;
   } else if (c->name == NAME_LONG) {
-    printf ("  assert (in_remaining (in) >= 8);\n");
     printf ("  *result = fetch_i64 (in);\n");
     printf ("  return result;\n");
     printf ("}\n");
     return;
   } else if (c->name == NAME_STRING || c->name == NAME_BYTES) {
-    printf ("  assert (in_remaining (in) >= 4);\n");
-    printf ("  ssize_t l = prefetch_strlen (in);\n");
-    printf ("  assert (l >= 0);\n");
     printf ("  result->len = l;\n");
-    printf ("  result->data = (decltype(result->data))malloc (l + 1);\n");
+    printf ("  result->data = (decltype(result->data))tl_ds_alloc (arena, l + 1);\n");
     printf ("  result->data[l] = 0;\n");
     printf ("  memcpy (result->data, fetch_str (in, l), l);\n");
     printf ("  return result;\n");
     printf ("}\n");
     return;
   } else if (c->name == NAME_DOUBLE) {
-    printf ("  assert (in_remaining (in) >= 8);\n");
     printf ("  *result = fetch_double (in);\n");
     printf ("  return result;\n");
     printf ("}\n");
@@ -1429,7 +1455,7 @@ void gen_constructor_fetch_ds (struct tl_combinator *c) {
   int empty = is_empty (((struct tl_tree_type *)c->result)->type);
 
   for (i = 0; i < c->args_num; i++) if (!(c->args[i]->flags & FLAG_OPT_VAR)) {
-    int result = gen_field_fetch_ds (c->args[i], vars, i + 1, empty);
+    int result = gen_field_fetch_ds (c->args[i], vars, i + 1, empty, c->name);
     (void)result;
     assert(result >= 0);
   }
@@ -1574,6 +1600,76 @@ void gen_type_skip (struct tl_type *t) {
   printf ("}\n");
 }
 
+void gen_type_view (struct tl_type *t) {
+  printf ("int view_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields, unsigned *magic) {\n", t->print_id);
+  printf ("  if (in_remaining (in) < 4) { return -1;}\n");
+  printf ("  *magic = fetch_i32 (in);\n");
+  printf ("  switch (*magic) {\n");
+  int i;
+  for (i = 0; i < t->constructors_num; i++) {
+     printf ("  case 0x%08x: return view_constructor_%s (in, T, fields);\n", t->constructors[i]->name, t->constructors[i]->print_id);
+  }
+  printf ("  default: return -1;\n");
+  printf ("  }\n");
+  printf ("}\n");
+  printf ("int view_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields, unsigned *magic) {\n", t->print_id);
+  if (t->constructors_num > 1) {
+    printf ("  struct tgl_in_buffer save_in = *in;\n");
+  }
+  for (i = 0; i < t->constructors_num; i++) {
+    printf ("  if (view_constructor_%s (in, T, fields) >= 0) { *magic = 0x%08x; return 0; }\n", t->constructors[i]->print_id, t->constructors[i]->name);
+    if (t->constructors_num > 1) {
+      printf ("  *in = save_in;\n");
+      printf ("  memset (fields, 0, TL_VIEW_MAX_FIELDS * sizeof (*fields));\n");
+    }
+  }
+  printf ("  return -1;\n");
+  printf ("}\n");
+}
+
+/* For every field name of the type (the names of the tl_ds_ struct members)
+   emits a function mapping a constructor magic to the index of that field
+   in the constructor, or -1 if the constructor doesn't have it. */
+void gen_type_view_fields (struct tl_type *t, int header) {
+  int j, k;
+  for (j = 0; j < t->constructors_num; j++) {
+    struct tl_combinator *c = t->constructors[j];
+    for (k = 0; k < c->args_num; k++) {
+      if ((c->args[k]->flags & FLAG_OPT_VAR) || !c->args[k]->id || !strlen (c->args[k]->id)) { continue; }
+      int l, m;
+      int seen = 0;
+      for (l = 0; l <= j && !seen; l++) {
+        struct tl_combinator *d = t->constructors[l];
+        for (m = 0; m < (l == j ? k : d->args_num) && !seen; m++) {
+          if (d->args[m]->id && !strcmp (d->args[m]->id, c->args[k]->id)) {
+            seen = 1;
+          }
+        }
+      }
+      if (seen) { continue; }
+
+      if (header) {
+        printf ("int view_field_%s_%s (unsigned magic);\n", t->print_id, c->args[k]->id);
+        continue;
+      }
+      printf ("int view_field_%s_%s (unsigned magic) {\n", t->print_id, c->args[k]->id);
+      printf ("  switch (magic) {\n");
+      for (l = j; l < t->constructors_num; l++) {
+        struct tl_combinator *d = t->constructors[l];
+        for (m = 0; m < d->args_num; m++) {
+          if (!(d->args[m]->flags & FLAG_OPT_VAR) && d->args[m]->id && !strcmp (d->args[m]->id, c->args[k]->id)) {
+            printf ("  case 0x%08x: return %d;\n", d->name, m);
+            break;
+          }
+        }
+      }
+      printf ("  default: return -1;\n");
+      printf ("  }\n");
+      printf ("}\n");
+    }
+  }
+}
+
 void gen_type_fetch (struct tl_type *t) {
   int empty = is_empty (t);;
   printf ("int fetch_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", t->print_id);
@@ -1707,29 +1803,29 @@ void gen_type_fetch_ds (struct tl_type *t) {
   //int empty = is_empty (t);;  
   print_c_type_name (t->constructors[0]->result, "", 0);
 
-  printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", t->print_id);
-  printf ("  assert (in_remaining (in) >= 4);\n");
+  printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena) {\n", t->print_id);
+  printf ("  if (in_remaining (in) < 4) { fetch_fail (in, 0); return NULL; }\n");
   printf ("  uint32_t magic = fetch_i32 (in);\n");
   printf ("  switch (magic) {\n");
   int i;
   for (i = 0; i < t->constructors_num; i++) {
-     printf ("  case 0x%08x: return fetch_ds_constructor_%s (in, T); break;\n", t->constructors[i]->name, t->constructors[i]->print_id);
+     printf ("  case 0x%08x: return fetch_ds_constructor_%s (in, T, arena); break;\n", t->constructors[i]->name, t->constructors[i]->print_id);
   }
-  printf ("  default: assert (0); return NULL;\n");
+  printf ("  default: in->ptr --; fetch_fail (in, magic); return NULL;\n");
   printf ("  }\n");
   printf ("}\n");
   print_c_type_name (t->constructors[0]->result, "", 0);
-  printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", t->print_id);
+  printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena) {\n", t->print_id);
   if (t->constructors_num > 1) {
     printf ("  struct tgl_in_buffer save_in = *in;\n");
   
     for (i = 0; i < t->constructors_num; i++) {
-      printf ("  if (skip_constructor_%s (in, T) >= 0) { *in = save_in; return fetch_ds_constructor_%s (in, T); }\n", t->constructors[i]->print_id, t->constructors[i]->print_id);
+      printf ("  if (skip_constructor_%s (in, T) >= 0) { *in = save_in; return fetch_ds_constructor_%s (in, T, arena); }\n", t->constructors[i]->print_id, t->constructors[i]->print_id);
     }
   } else {
-    printf ("  return fetch_ds_constructor_%s (in, T);\n", t->constructors[0]->print_id);
+    printf ("  return fetch_ds_constructor_%s (in, T, arena);\n", t->constructors[0]->print_id);
   }
-  printf ("  assert (0);\n");
+  printf ("  fetch_fail (in, 0);\n");
   printf ("  return NULL;\n");
   printf ("}\n");
 }
@@ -2218,7 +2314,7 @@ void gen_skip_source (void) {
   int i, j;
   for (i = 0; i < tn; i++) {
     for (j = 0; j < tps[i]->constructors_num; j ++) {
-      gen_constructor_skip (tps[i]->constructors[j]);
+      gen_constructor_skip (tps[i]->constructors[j], 0);
     }
   }
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
@@ -2237,6 +2333,83 @@ void gen_skip_source (void) {
   printf ("}\n");
 }
 
+int view_max_fields (void) {
+  int i, j;
+  int max = 1;
+  for (i = 0; i < tn; i++) {
+    for (j = 0; j < tps[i]->constructors_num; j ++) {
+      if (tps[i]->constructors[j]->args_num > max) {
+        max = tps[i]->constructors[j]->args_num;
+      }
+    }
+  }
+  return max;
+}
+
+void gen_view_header (void) {
+  printf ("#pragma once\n");
+  printf ("#include \"auto/auto.h\"\n");
+  printf ("#include <assert.h>\n");
+
+  printf ("namespace tgl {\n");
+  printf ("namespace impl {\n");
+
+  printf ("struct tgl_in_buffer;\n");
+  printf ("#define TL_VIEW_MAX_FIELDS %d\n", view_max_fields ());
+
+  int i, j;
+  for (i = 0; i < tn; i++) {
+    for (j = 0; j < tps[i]->constructors_num; j ++) {
+      printf ("int view_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields);\n", tps[i]->constructors[j]->print_id);
+    }
+  }
+  for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
+    printf ("int view_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields, unsigned *magic);\n", tps[i]->print_id);
+    printf ("int view_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields, unsigned *magic);\n", tps[i]->print_id);
+    gen_type_view_fields (tps[i], 1);
+  }
+  printf ("int view_type_any (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields, unsigned *magic);\n");
+
+  printf ("}\n");
+  printf ("}\n");
+}
+
+void gen_view_source (void) {
+  printf ("#include \"auto/auto.h\"\n");
+  printf ("#include <assert.h>\n");
+  printf ("#include <string.h>\n");
+
+  printf ("#include \"auto/auto_skip.h\"\n");
+  printf ("#include \"auto/auto_types.h\"\n");
+  printf ("#include \"auto/auto_view.h\"\n");
+  printf ("#include \"mtproto_common.h\"\n");
+
+  printf ("namespace tgl {\n");
+  printf ("namespace impl {\n");
+
+  int i, j;
+  for (i = 0; i < tn; i++) {
+    for (j = 0; j < tps[i]->constructors_num; j ++) {
+      gen_constructor_skip (tps[i]->constructors[j], 1);
+    }
+  }
+  for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
+    gen_type_view (tps[i]);
+    gen_type_view_fields (tps[i], 0);
+  }
+  printf ("int view_type_any (struct tgl_in_buffer *in, const struct paramed_type *T, const int32_t **fields, unsigned *magic) {\n");
+  printf ("  switch (T->type.name) {\n");
+  for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type") && tps[i]->name) {
+    printf ("  case 0x%08x: return view_type_%s (in, T, fields, magic);\n", tps[i]->name, tps[i]->print_id);
+    printf ("  case 0x%08x: return view_type_bare_%s (in, T, fields, magic);\n", ~tps[i]->name, tps[i]->print_id);
+  }
+  printf ("  default: return -1; }\n");
+  printf ("}\n");
+
+  printf ("}\n");
+  printf ("}\n");
+}
+
 void gen_fetch_header (void) {
   printf ("#include \"auto/auto.h\"\n");
   printf ("#include <assert.h>\n");
@@ -2593,13 +2766,13 @@ void gen_fetch_ds_source (void) {
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
     gen_type_fetch_ds (tps[i]);
   }
-  printf ("void *fetch_ds_type_any (struct tgl_in_buffer *in, const struct paramed_type *T) {\n");
+  printf ("void *fetch_ds_type_any (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena) {\n");
   printf ("  switch (T->type.name) {\n");
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type") && tps[i]->name) {
-    printf ("  case 0x%08x: return fetch_ds_type_%s (in, T);\n", tps[i]->name, tps[i]->print_id);
-    printf ("  case 0x%08x: return fetch_ds_type_bare_%s (in, T);\n", ~tps[i]->name, tps[i]->print_id);
+    printf ("  case 0x%08x: return fetch_ds_type_%s (in, T, arena);\n", tps[i]->name, tps[i]->print_id);
+    printf ("  case 0x%08x: return fetch_ds_type_bare_%s (in, T, arena);\n", ~tps[i]->name, tps[i]->print_id);
   }
-  printf ("  default: return NULL; }\n");
+  printf ("  default: fetch_fail (in, 0); return NULL; }\n");
   printf ("}\n");
 
   printf ("}\n");
@@ -2620,16 +2793,16 @@ void gen_fetch_ds_header (void) {
   for (i = 0; i < tn; i++) {
     for (j = 0; j < tps[i]->constructors_num; j ++) {
       print_c_type_name (tps[i]->constructors[j]->result, "", 0);
-      printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T);\n", tps[i]->constructors[j]->print_id);
+      printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena = nullptr);\n", tps[i]->constructors[j]->print_id);
     }
   }
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
     print_c_type_name (tps[i]->constructors[0]->result, "", 0);
-    printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T);\n", tps[i]->print_id);
+    printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena = nullptr);\n", tps[i]->print_id);
     print_c_type_name (tps[i]->constructors[0]->result, "", 0);
-    printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T);\n", tps[i]->print_id);
+    printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena = nullptr);\n", tps[i]->print_id);
   }
-  printf ("void *fetch_ds_type_any (struct tgl_in_buffer *in, const struct paramed_type *T);\n");
+  printf ("void *fetch_ds_type_any (struct tgl_in_buffer *in, const struct paramed_type *T, tl_ds_arena *arena = nullptr);\n");
 
   printf ("}\n");
   printf ("}\n");
@@ -2870,6 +3043,10 @@ int parse_tlo_file (void) {
       gen_skip_source ();
     } else if (!strcmp (gen_what[i], "skip_header")) {
       gen_skip_header ();
+    } else if (!strcmp (gen_what[i], "view")) {
+      gen_view_source ();
+    } else if (!strcmp (gen_what[i], "view_header")) {
+      gen_view_header ();
     } else if (!strcmp (gen_what[i], "store")) {
       gen_store_source ();
     } else if (!strcmp (gen_what[i], "store_header")) {
@@ -92,6 +92,7 @@ public:
     virtual ssize_t read(void* buffer, size_t len) override;
     virtual ssize_t write(const void* data, size_t len) override;
     virtual ssize_t peek(void* data, size_t len) override;
+    virtual bool read_frame(size_t len, tgl_net_frame& frame) override;
     virtual size_t available_bytes_for_read() override { return m_available_bytes_for_read; }
     virtual void flush() override;
     virtual tgl_connection_status status() const override { return m_connection_status; }
@@ -21,7 +21,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <functional>
 #include <iostream>
 #include <string>
@@ -38,6 +40,35 @@ using tgl_log_function = std::function<void(const std::string& log, tgl_log_leve
 void tgl_init_log(const tgl_log_function& log_function, tgl_log_level level);
 void tgl_log(const std::string& str, tgl_log_level level);
 
+// One log line with its parts kept apart. The strings are only valid during
+// the call to the log function.
+struct tgl_log_record
+{
+    tgl_log_level level;
+    const char* location; // "file.cpp:123"
+    const char* function;
+    const char* message;
+    size_t message_size;
+};
+
+using tgl_structured_log_function = std::function<void(const tgl_log_record& record)>;
+// Replaces the function set by tgl_init_log().
+void tgl_init_structured_log(const tgl_structured_log_function& log_function, tgl_log_level level);
+
+// The most verbose level anyone listens to, -1 if nobody does. The logging
+// macros check it before formatting anything.
+extern std::atomic<int> g_tgl_log_threshold;
+
+inline bool tgl_log_enabled(tgl_log_level level)
+{
+    return static_cast<int>(level) <= g_tgl_log_threshold.load(std::memory_order_relaxed);
+}
+
+// Used by the logging macros: tgl_log_begin() hands out a per-thread stream
+// whose buffer is reused from line to line, tgl_log_end() passes the line on.
+std::ostream& tgl_log_begin(const char* location, const char* function);
+void tgl_log_end(tgl_log_level level);
+
 constexpr int32_t basename_index(const char* const path, const int32_t index = 0, const int32_t slash_index = -1) {
     return path[index]
         ? (path[index] == '/' ? basename_index(path, index + 1, index) : basename_index(path, index + 1, slash_index))
@@ -53,26 +84,19 @@ constexpr int32_t basename_index(const char* const path, const int32_t index = 0
 
 #define TGL_CRASH() do { *reinterpret_cast<int*>(0xbadbeef) = 0; abort(); } while (false)
 
+#define TGL_LOG(LEVEL, X) do { if (tgl_log_enabled(LEVEL)) { \
+                    tgl_log_begin(__FILELINE__, __FUNCTION__) << X; \
+                    tgl_log_end(LEVEL);} } while (false)
+
 #ifndef NDEBUG
-#define TGL_DEBUG(X) do { std::ostringstream str_stream; \
-                    str_stream << "[" << __FILELINE__ << "] [" << __FUNCTION__ << "]" << X ; \
-                    tgl_log(str_stream.str(), tgl_log_level::level_debug);} while (false)
+#define TGL_DEBUG(X) TGL_LOG(tgl_log_level::level_debug, X)
 #else
 #define TGL_DEBUG(X)
 #endif
 
-#define TGL_NOTICE(X) do { std::ostringstream str_stream; \
-                    str_stream << "[" << __FILELINE__ << "] [" << __FUNCTION__ << "]" << X ; \
-                    tgl_log(str_stream.str(), tgl_log_level::level_notice);} while (false)
-
-#define TGL_WARNING(X) do { std::ostringstream str_stream; \
-                    str_stream << "[" << __FILELINE__ << "] [" << __FUNCTION__ << "]" << X ; \
-                    tgl_log(str_stream.str(), tgl_log_level::level_warning);} while (false)
-
-#define TGL_ERROR(X) do { std::ostringstream str_stream; \
-                    str_stream << "[" << __FILELINE__ << "] [" << __FUNCTION__ << "]" << X ; \
-                    tgl_log(str_stream.str(), tgl_log_level::level_error);} while (false)
-
+#define TGL_NOTICE(X) TGL_LOG(tgl_log_level::level_notice, X)
+#define TGL_WARNING(X) TGL_LOG(tgl_log_level::level_warning, X)
+#define TGL_ERROR(X) TGL_LOG(tgl_log_level::level_error, X)
 
 #define TGL_ASSERT(x) assert(x)
 #define TGL_ASSERT_UNUSED(u, x) do { static_cast<void>(u); assert(x); } while (false)
@@ -20,17 +20,134 @@
 */
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "tgl_connection_status.h"
 
+// What a query is for. File transfers go over their own connections so
+// nothing the user waits for queues up behind their parts.
+enum class tgl_query_class
+{
+    interactive, // what the user is waiting for, like sending a message
+    background, // keeping the local state in sync
+    bulk, // file transfers
+};
+
+// Latencies in microseconds. Values below 16 get a bucket each, above that
+// every power of two is split into 8 buckets so no bucket is wider than 1/8
+// of its values. Values beyond about two minutes go into the last bucket.
+struct tgl_latency_histogram
+{
+    static constexpr size_t BUCKETS = 200;
+
+    std::array<uint64_t, BUCKETS> counts {};
+    uint64_t count = 0;
+    uint64_t max = 0;
+
+    static size_t bucket_of(uint64_t value)
+    {
+        if (value < 16) {
+            return static_cast<size_t>(value);
+        }
+        size_t exponent = 63 - __builtin_clzll(value);
+        size_t bucket = (exponent - 2) * 8 + ((value >> (exponent - 3)) & 7);
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
+    }
+
+    static uint64_t bucket_lower_bound(size_t bucket)
+    {
+        if (bucket < 16) {
+            return bucket;
+        }
+        size_t exponent = bucket / 8 + 2;
+        return static_cast<uint64_t>(8 + bucket % 8) << (exponent - 3);
+    }
+
+    void record(uint64_t value)
+    {
+        counts[bucket_of(value)]++;
+        count++;
+        if (value > max) {
+            max = value;
+        }
+    }
+
+    // The upper bound of the bucket holding the given percentile (0 to 100),
+    // 0 if nothing was recorded.
+    uint64_t value_at_percentile(double percentile) const
+    {
+        uint64_t rank = static_cast<uint64_t>(percentile / 100 * count + 0.5);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen && seen >= rank) {
+                return i + 1 < BUCKETS ? std::min(bucket_lower_bound(i + 1) - 1, max) : max;
+            }
+        }
+        return max;
+    }
+};
+
+struct tgl_query_stats
+{
+    uint64_t in_flight = 0; // sent and not answered yet
+    uint64_t completed = 0; // answered or failed
+    tgl_latency_histogram latency; // from execute to the answer or the final error
+};
+
+struct tgl_request_cache_stats
+{
+    uint64_t coalesced = 0; // joined an identical request in flight
+    uint64_t cache_hits = 0; // answered from a recent result
+    uint64_t misses = 0; // sent to the server
+};
+
+struct tgl_rpc_metrics
+{
+    uint64_t executed = 0;
+    uint64_t answered = 0;
+    uint64_t failed = 0; // gave up with an error
+    uint64_t retries = 0; // sent again after a timeout or a handled error
+    uint64_t timeouts = 0;
+    std::map<int32_t, uint64_t> error_codes; // every error, including the ones retried
+    tgl_latency_histogram latency; // from execute to the answer or the final error
+};
+
+struct tgl_query_metrics
+{
+    std::map<std::string, tgl_rpc_metrics> by_method; // by query name
+    std::map<int32_t, tgl_rpc_metrics> by_dc;
+
+    // Gauges, taken when the snapshot is.
+    uint64_t active_queries = 0; // sent and waiting for an answer
+    uint64_t pending_queries = 0; // waiting for their DC to be ready
+    uint64_t retrying_queries = 0; // waiting to be sent again
+};
+
 struct tgl_net_stats
 {
     uint64_t bytes_sent;
     uint64_t bytes_received;
+    uint64_t peak_inflate_buffer_size; // the largest buffer needed to inflate a gzip_packed response
+    uint64_t frames_received;
+    uint64_t frame_bytes_copied; // bytes copied to make inbound frames contiguous
+};
+
+// A contiguous and writable inbound frame. The owner keeps the bytes alive
+// while the frame is processed, even if the connection drops its buffers.
+struct tgl_net_frame
+{
+    char* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<void> owner;
 };
 
 class tgl_connection {
@@ -40,6 +157,9 @@ public:
     virtual ssize_t write(const void* data, size_t len) = 0;
     virtual ssize_t read(void* data, size_t len) = 0;
     virtual ssize_t peek(void* data, size_t len) = 0;
+    // Consumes the next len bytes without copying them if they are already
+    // contiguous and 4-byte aligned. Returns false if the caller has to read() them.
+    virtual bool read_frame(size_t /*len*/, tgl_net_frame& /*frame*/) { return false; }
     virtual size_t available_bytes_for_read() = 0;
     virtual void flush() = 0;
     virtual tgl_connection_status status() const = 0;
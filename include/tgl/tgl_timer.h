@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <functional>
 
@@ -34,5 +35,11 @@ public:
 class tgl_timer_factory {
 public:
     virtual std::shared_ptr<tgl_timer> create_timer(const std::function<void()>& cb) = 0;
+    // Seconds on the clock the timers count down on. The transfer rate limits
+    // read it too, so a fake factory can drive both in tests.
+    virtual double monotonic_time() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() * 1e-9;
+    }
     virtual ~tgl_timer_factory() { }
 };
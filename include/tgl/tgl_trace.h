@@ -0,0 +1,62 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class tgl_trace_event_type: uint8_t
+{
+    message_queued, // msg_id and size of an outgoing message
+    frame_received, // size of an encrypted frame read from a connection
+    message_received, // msg_id and size of a decrypted incoming message
+    query_result, // msg_id of the query and size of its answer
+    query_resent,
+    query_regenerated,
+    bad_server_salt, // msg_id of the message sent with the old salt
+};
+
+struct tgl_trace_event
+{
+    uint64_t time; // nanoseconds on the monotonic clock
+    int64_t msg_id;
+    uint32_t size;
+    uint32_t thread; // the order in which threads first traced something
+    int16_t dc_id;
+    tgl_trace_event_type type;
+};
+
+// Each thread records into a ring buffer of events_per_thread events. Once it
+// is full the oldest events are overwritten. While tracing is stopped the
+// trace points cost a relaxed atomic load.
+void tgl_start_tracing(size_t events_per_thread);
+void tgl_stop_tracing();
+
+// The events currently in the buffers, ordered by time. This may be called
+// while tracing.
+std::vector<tgl_trace_event> tgl_dump_trace();
+
+// Turns events into the Trace Event Format read by chrome://tracing and
+// Perfetto. Each DC shows up as a process. Queries whose sending and answer
+// are both in the dump also show up as spans.
+std::string tgl_trace_to_chrome_json(const std::vector<tgl_trace_event>& events);
@@ -25,6 +25,7 @@
 #include "tgl_peer_id.h"
 #include "tgl_message.h"
 
+#include <array>
 #include <cassert>
 #include <functional>
 #include <iostream>
@@ -145,8 +146,51 @@ struct tgl_download_document
 using tgl_download_callback = std::function<void(tgl_download_status, const std::string& file_name, int64_t downloaded_bytes)>;
 using tgl_upload_callback = std::function<void(tgl_upload_status, const std::shared_ptr<tgl_message>& message, int64_t uploaded_bytes)>;
 using tgl_read_callback = std::function<std::shared_ptr<std::vector<uint8_t>>(uint32_t chunk_size)>;
+using tgl_read_at_callback = std::function<std::shared_ptr<std::vector<uint8_t>>(uint64_t offset, uint32_t chunk_size)>;
 using tgl_upload_part_done_callback = std::function<void()>;
 
+// How a file is split into parts for a transfer and why.
+struct tgl_part_size_choice
+{
+    uint32_t part_size = 0;
+    uint32_t part_count = 0; // 0 if the file size is unknown
+    std::string reason;
+};
+
+struct tgl_batch_download_result
+{
+    tgl_file_location location;
+    tgl_download_status status = tgl_download_status::failed; // succeeded or failed
+    std::string file_name;
+};
+
+// Gets the results in the order of the locations.
+using tgl_batch_download_callback = std::function<void(const std::vector<tgl_batch_download_result>& results)>;
+
+// The SHA-256 of a range of a file as the server stores it, which is how
+// upload.getFileHashes describes a file.
+struct tgl_file_hash
+{
+    int32_t offset = 0;
+    int32_t limit = 0;
+    std::array<unsigned char, 32> hash;
+};
+
+// Called with the download id or the message id of an upload.
+using tgl_part_size_callback = std::function<void(int64_t transfer_id, const tgl_part_size_choice& choice)>;
+
+// Where the time of an upload went, summed over its parts. Parts overlap each
+// other, so the sums can add up to more than the upload took; the largest one
+// is the stage holding the upload back.
+struct tgl_upload_stage_times
+{
+    double read_seconds = 0;
+    double encrypt_seconds = 0; // secret chats only
+    double send_seconds = 0; // from sending a part until the server has acknowledged it
+};
+
+using tgl_upload_stage_times_callback = std::function<void(int64_t message_id, const tgl_upload_stage_times& times)>;
+
 class tgl_transfer_manager
 {
 public:
@@ -156,6 +200,17 @@ public:
 
     virtual bool file_exists(const tgl_file_location &location) const = 0;
 
+    // Finished downloads are kept in a cache indexed by location, so a
+    // location downloaded before completes right away without touching the
+    // network. Returns an empty string if the location isn't cached. Cheap
+    // enough to call for every incoming media message.
+    virtual std::string cached_file_path(const tgl_file_location& location) = 0;
+
+    // Files are removed least recently used first once the cache takes up
+    // more than bytes. Downloads with the same content share their disk space.
+    // 0, the default, means no limit.
+    virtual void set_download_cache_budget(uint64_t bytes) = 0;
+
     // Parameter is either secret or access hash depending on file type
     virtual std::string get_file_path(int64_t secret) const = 0;
 
@@ -167,6 +222,47 @@ public:
 
     virtual void cancel_download(int64_t download_id) = 0;
 
+    // Downloads many small files like avatars and thumbnails at once. They
+    // are requested in parts of up to 512 KB with many requests in flight per
+    // DC, which get packed into few containers, and cached locations are
+    // served from the download cache. The requests count toward the per DC
+    // cap of set_download_concurrency() and the rate limit like any part.
+    virtual void download_batch(const std::vector<tgl_file_location>& locations,
+            const tgl_batch_download_callback& callback) = 0;
+
+    // Makes the next download of location check every part against hashes.
+    // A part which doesn't match is requested again on its own. The ranges
+    // have to be of the same power of two size, which the download then uses
+    // as its part size.
+    virtual void set_file_hashes(const tgl_file_location& location, const std::vector<tgl_file_hash>& hashes) = 0;
+
+    // Caps the number of parts requested at a time for one file and for all
+    // files on the same DC. Within the per file cap the number adapts to how
+    // long parts take to arrive.
+    virtual void set_download_concurrency(size_t max_parts_per_file, size_t max_parts_per_dc) = 0;
+
+    // Caps the bytes per second all transfers together send and receive. 0,
+    // the default, means no limit. Parts wait for their turn rather than
+    // being sent in a burst.
+    virtual void set_rate_limit(uint64_t bytes_per_second) = 0;
+
+    // Caps a download or upload in progress on its own. Under the overall
+    // limit transfers get shares of it in proportion to their weight, which
+    // is 1 unless set here.
+    virtual void set_download_share(int64_t download_id, uint64_t max_bytes_per_second, double weight) = 0;
+    virtual void set_upload_share(int64_t message_id, uint64_t max_bytes_per_second, double weight) = 0;
+
+    // The part size is picked for every transfer from the file size and what
+    // has been measured on its DC so far, unless file hashes set for a download
+    // or the state of a resumed upload fix it. The callback is told about each
+    // choice.
+    virtual void set_part_size_callback(const tgl_part_size_callback& callback) = 0;
+
+    // Called when an upload ends.
+    virtual void set_upload_stage_times_callback(const tgl_upload_stage_times_callback& callback) = 0;
+
+    // The upload functions below read the file at document->file_name
+    // directly through a memory mapping if no read callback is given.
     virtual void upload_document(const tgl_input_peer_t& to_id, int64_t message_id,
             const std::shared_ptr<tgl_upload_document>& document,
             tgl_upload_option option,
@@ -175,6 +271,18 @@ public:
             const tgl_upload_part_done_callback& part_done_callback,
             int32_t reply = 0) = 0;
 
+    // Like upload_document but parts are read by offset and the progress is
+    // kept in the upload state storage of the user agent. If it has progress
+    // of an earlier upload for the same message_id and file size, only the
+    // parts the server hasn't acknowledged yet are sent.
+    virtual void upload_resumable_document(const tgl_input_peer_t& to_id, int64_t message_id,
+            const std::shared_ptr<tgl_upload_document>& document,
+            tgl_upload_option option,
+            const tgl_upload_callback& callback,
+            const tgl_read_at_callback& read_callback,
+            const tgl_upload_part_done_callback& part_done_callback,
+            int32_t reply = 0) = 0;
+
     // Upload self profile photo. The server will cut central square from this photo.
     virtual void upload_profile_photo(const std::string &file_name, int32_t file_size,
             const std::function<void(bool success)>& callback,
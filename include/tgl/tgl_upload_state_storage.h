@@ -0,0 +1,56 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Everything it takes to pick an upload up where it stopped. For uploads to
+// secret chats it includes the file key, so it has to be kept as safe as the
+// secret chats themselves.
+struct tgl_upload_state
+{
+    int64_t message_id = 0;
+    int64_t file_id = 0;
+    uint64_t size = 0;
+    uint32_t part_size = 0;
+    std::vector<bool> acknowledged_parts;
+
+    // Secret chats only. Every part is encrypted with the IV the part before
+    // it left behind, so the upload continues from encrypted_parts with iv.
+    std::vector<unsigned char> key;
+    std::vector<unsigned char> init_iv;
+    std::vector<unsigned char> iv;
+    uint32_t encrypted_parts = 0;
+};
+
+class tgl_upload_state_storage {
+public:
+    virtual ~tgl_upload_state_storage() { }
+
+    // Replaces whatever was stored for the same message id.
+    virtual void store_upload_state(const tgl_upload_state& state) = 0;
+
+    virtual std::shared_ptr<tgl_upload_state> load_upload_state(int64_t message_id) = 0;
+
+    virtual void remove_upload_state(int64_t message_id) = 0;
+};
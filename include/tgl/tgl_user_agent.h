@@ -38,6 +38,7 @@ class tgl_transfer_manager;
 class tgl_timer_factory;
 class tgl_unconfirmed_secret_message_storage;
 class tgl_update_callback;
+class tgl_upload_state_storage;
 
 class tgl_user_agent: public tgl_query_api
 {
@@ -73,6 +74,29 @@ public:
     virtual void set_pfs_enabled(bool) = 0;
     virtual void set_ipv6_enabled(bool) = 0;
 
+    // Outgoing messages are packed into one msg_container per connection until
+    // max_batch_size bytes are queued or max_batch_delay seconds have passed.
+    // A max_batch_size of 0 sends every message on its own.
+    virtual void set_message_batching(size_t max_batch_size, double max_batch_delay) = 0;
+
+    // Encrypts and decrypts frames and file parts of at least min_size bytes
+    // on thread_count worker threads instead of the calling thread. Callbacks
+    // still come from the timer factory, which has to be set first. The
+    // threads are started by the first call with a non-zero thread_count and
+    // are kept until the user agent goes away; a thread_count of 0 turns
+    // offloading off.
+    virtual void set_crypto_offload(size_t thread_count, size_t min_size) = 0;
+
+    // File transfers are spread over up to count extra connections per DC,
+    // which leaves the main connection to everything else. A count of 0
+    // sends them over the main connection.
+    virtual void set_media_connections(size_t count) = 0;
+
+    // Identical user, chat, channel and username lookups made while one is
+    // in flight share its answer. A successful answer is reused for
+    // result_ttl seconds; 0 keeps only the sharing of queries in flight.
+    virtual void set_request_coalescing(double result_ttl) = 0;
+
     virtual void reset_authorization() = 0;
     virtual void add_rsa_key(const std::string& key) = 0;
 
@@ -93,6 +117,8 @@ public:
     virtual void set_timer_factory(const std::shared_ptr<tgl_timer_factory>& factory) = 0;
     virtual tgl_transfer_manager* transfer_manager() const = 0;
     virtual void set_unconfirmed_secret_message_storage(const std::shared_ptr<tgl_unconfirmed_secret_message_storage>& storage) = 0;
+    // Where resumable uploads keep their progress.
+    virtual void set_upload_state_storage(const std::shared_ptr<tgl_upload_state_storage>& storage) = 0;
 
     virtual int32_t create_secret_chat_id() const = 0;
 
@@ -110,4 +136,10 @@ public:
             const unsigned char* exchange_key) = 0;
 
     virtual tgl_net_stats get_net_stats(bool reset_after_get = true) = 0;
+    // Resetting leaves the number of queries in flight alone.
+    virtual tgl_query_stats get_query_stats(tgl_query_class query_class, bool reset_after_get = true) = 0;
+    virtual tgl_request_cache_stats get_request_cache_stats(bool reset_after_get = true) = 0;
+    // Counters and latencies of queries by name and by DC, with the current
+    // number of queries in flight, pending and waiting to be retried.
+    virtual tgl_query_metrics get_query_metrics(bool reset_after_get = true) = 0;
 };
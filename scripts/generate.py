@@ -166,6 +166,6 @@ r = build_lib.run_command(os.path.join(".", "tl-parser", "bin", "tl-parser") + "
 if r != 0:
     sys.exit(r)
 
-for what in ["fetch_ds", "free_ds", "skip", "types"]:
+for what in ["fetch_ds", "free_ds", "skip", "types", "view"]:
     generate_by_name(what, is_header=True)
     generate_by_name(what, is_header=False)
@@ -74,5 +74,11 @@ static inline void *memdup (const void *d, int len) {
 
 void tgl_paramed_type_free(struct paramed_type *P);
 
+class tl_ds_arena;
+
+// Allocates zero-filled memory for the fetch_ds_* functions, from the
+// arena if one is given and from the heap otherwise.
+void* tl_ds_alloc(tl_ds_arena* arena, size_t size);
+
 }
 }
@@ -0,0 +1,203 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Ben Wiederhake 2015
+*/
+
+#include "crypto/crypto_aes.h"
+
+#include <utility>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TGLC_HAVE_AES_NI 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define TGLC_AES_NI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+namespace tgl {
+namespace impl {
+
+#ifdef TGLC_HAVE_AES_NI
+
+static bool detect_aes_ni()
+{
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+bool TGLC_aes_ni_available()
+{
+    static const bool available = detect_aes_ni();
+    return available;
+}
+
+TGLC_AES_NI_TARGET static inline __m128i expand_key_even(__m128i key, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    __m128i t = _mm_slli_si128(key, 4);
+    key = _mm_xor_si128(key, t);
+    t = _mm_slli_si128(t, 4);
+    key = _mm_xor_si128(key, t);
+    t = _mm_slli_si128(t, 4);
+    key = _mm_xor_si128(key, t);
+    return _mm_xor_si128(key, assist);
+}
+
+TGLC_AES_NI_TARGET static inline __m128i expand_key_odd(__m128i even_key, __m128i key)
+{
+    __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(even_key, 0x00), 0xaa);
+    __m128i t = _mm_slli_si128(key, 4);
+    key = _mm_xor_si128(key, t);
+    t = _mm_slli_si128(t, 4);
+    key = _mm_xor_si128(key, t);
+    t = _mm_slli_si128(t, 4);
+    key = _mm_xor_si128(key, t);
+    return _mm_xor_si128(key, assist);
+}
+
+TGLC_AES_NI_TARGET static void expand_key_256(const unsigned char* user_key, __m128i rk[15])
+{
+    rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(user_key));
+    rk[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(user_key + 16));
+    // _mm_aeskeygenassist_si128 needs the round constant as an immediate.
+#define TGLC_EXPAND_ROUND(i, rcon) \
+    rk[i] = expand_key_even(rk[i - 2], _mm_aeskeygenassist_si128(rk[i - 1], rcon)); \
+    if (i + 1 < 15) { rk[i + 1] = expand_key_odd(rk[i], rk[i - 1]); }
+    TGLC_EXPAND_ROUND(2, 0x01)
+    TGLC_EXPAND_ROUND(4, 0x02)
+    TGLC_EXPAND_ROUND(6, 0x04)
+    TGLC_EXPAND_ROUND(8, 0x08)
+    TGLC_EXPAND_ROUND(10, 0x10)
+    TGLC_EXPAND_ROUND(12, 0x20)
+    TGLC_EXPAND_ROUND(14, 0x40)
+#undef TGLC_EXPAND_ROUND
+}
+
+TGLC_AES_NI_TARGET static bool aes_ni_set_key(const unsigned char* userKey, TGLC_aes_key* key, const int enc)
+{
+    __m128i rk[15];
+    expand_key_256(userKey, rk);
+    __m128i* out = reinterpret_cast<__m128i*>(key->round_keys);
+    if (enc) {
+        for (int i = 0; i < 15; ++i) {
+            _mm_storeu_si128(out + i, rk[i]);
+        }
+    } else {
+        // The equivalent inverse cipher: reversed round keys with InvMixColumns
+        // applied to all but the first and the last one.
+        _mm_storeu_si128(out, rk[14]);
+        for (int i = 1; i < 14; ++i) {
+            _mm_storeu_si128(out + i, _mm_aesimc_si128(rk[14 - i]));
+        }
+        _mm_storeu_si128(out + 14, rk[0]);
+    }
+    for (int i = 0; i < 15; ++i) {
+        rk[i] = _mm_setzero_si128();
+    }
+    return true;
+}
+
+bool TGLC_aes_ni_set_key(const unsigned char* userKey, const int bits, TGLC_aes_key* key, const int enc)
+{
+    if (bits != 256 || !TGLC_aes_ni_available()) {
+        return false;
+    }
+    return aes_ni_set_key(userKey, key, enc);
+}
+
+// IGE chains every block on both the previous plaintext and the previous
+// ciphertext block, so neither direction can be pipelined across blocks.
+// What we win over AES_ige_encrypt is the AES-NI rounds with the key
+// schedule held in registers for the whole buffer.
+TGLC_AES_NI_TARGET void TGLC_aes_ni_ige_encrypt(const unsigned char* in, unsigned char* out, size_t length,
+        const TGLC_aes_key* key, unsigned char* ivec, const int enc)
+{
+    assert(key->hardware);
+    assert(length % 16 == 0);
+
+    const __m128i* round_keys = reinterpret_cast<const __m128i*>(key->round_keys);
+    __m128i rk[15];
+    for (int i = 0; i < 15; ++i) {
+        rk[i] = _mm_loadu_si128(round_keys + i);
+    }
+
+    // Same layout as OpenSSL: the first half of ivec is xored into the
+    // cipher input, the second half into its output.
+    __m128i iv1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ivec));
+    __m128i iv2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ivec + 16));
+    if (!enc) {
+        std::swap(iv1, iv2);
+    }
+
+    size_t blocks = length / 16;
+    for (size_t n = 0; n < blocks; ++n) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in) + n);
+        __m128i x = _mm_xor_si128(_mm_xor_si128(block, iv1), rk[0]);
+        if (enc) {
+            for (int r = 1; r < 14; ++r) {
+                x = _mm_aesenc_si128(x, rk[r]);
+            }
+            x = _mm_aesenclast_si128(x, rk[14]);
+        } else {
+            for (int r = 1; r < 14; ++r) {
+                x = _mm_aesdec_si128(x, rk[r]);
+            }
+            x = _mm_aesdeclast_si128(x, rk[14]);
+        }
+        x = _mm_xor_si128(x, iv2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + n, x);
+        iv1 = x;
+        iv2 = block;
+    }
+
+    if (!enc) {
+        std::swap(iv1, iv2);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ivec), iv1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ivec + 16), iv2);
+
+    for (int i = 0; i < 15; ++i) {
+        rk[i] = _mm_setzero_si128();
+    }
+}
+
+#else
+
+bool TGLC_aes_ni_available()
+{
+    return false;
+}
+
+bool TGLC_aes_ni_set_key(const unsigned char*, const int, TGLC_aes_key*, const int)
+{
+    return false;
+}
+
+void TGLC_aes_ni_ige_encrypt(const unsigned char*, unsigned char*, size_t, const TGLC_aes_key*, unsigned char*, const int)
+{
+    assert(false);
+}
+
+#endif
+
+}
+}
@@ -20,33 +20,78 @@
 
 #pragma once
 
+#include "crypto_mem.h"
+
 #include <openssl/aes.h>
 
 #include <cstddef>
 #include <cassert>
+#include <cstring>
+#include <memory>
 
 namespace tgl {
 namespace impl {
 
-typedef AES_KEY TGLC_aes_key;
+struct TGLC_aes_key
+{
+    AES_KEY openssl_key;
+    // AES-256 round keys in the order they are applied, used instead of
+    // openssl_key when the CPU has AES-NI.
+    unsigned char round_keys[15 * 16];
+    bool hardware;
+};
+
+// Both return false if AES-NI is not available or the key is not 256 bits.
+bool TGLC_aes_ni_set_key(const unsigned char* userKey, const int bits, TGLC_aes_key* key, const int enc);
+bool TGLC_aes_ni_available();
+
+void TGLC_aes_ni_ige_encrypt(const unsigned char* in, unsigned char* out, size_t length, const TGLC_aes_key* key, unsigned char* ivec, const int enc);
 
 inline static void TGLC_aes_set_encrypt_key(const unsigned char* userKey, const int bits, TGLC_aes_key* key)
 {
-    int success = AES_set_encrypt_key(userKey, bits, key);
+    key->hardware = TGLC_aes_ni_set_key(userKey, bits, key, 1);
+    if (key->hardware) {
+        return;
+    }
+    int success = AES_set_encrypt_key(userKey, bits, &key->openssl_key);
     (void)success;
     assert(0 == success);
 }
 
 inline static void TGLC_aes_set_decrypt_key(const unsigned char* userKey, const int bits, TGLC_aes_key* key)
 {
-    int success = AES_set_decrypt_key(userKey, bits, key);
+    key->hardware = TGLC_aes_ni_set_key(userKey, bits, key, 0);
+    if (key->hardware) {
+        return;
+    }
+    int success = AES_set_decrypt_key(userKey, bits, &key->openssl_key);
     (void)success;
     assert(0 == success);
 }
 
+// An expanded key schedule which is shared by everything encrypted with the
+// same key and wiped when the last user lets go of it.
+inline static std::shared_ptr<const TGLC_aes_key> TGLC_aes_make_key(const unsigned char* userKey, const int bits, const int enc)
+{
+    std::shared_ptr<TGLC_aes_key> key(new TGLC_aes_key, [](TGLC_aes_key* key) {
+        TGLC_cleanse(key, sizeof(*key));
+        delete key;
+    });
+    if (enc) {
+        TGLC_aes_set_encrypt_key(userKey, bits, key.get());
+    } else {
+        TGLC_aes_set_decrypt_key(userKey, bits, key.get());
+    }
+    return key;
+}
+
 inline static void TGLC_aes_ige_encrypt(const unsigned char* in, unsigned char* out, size_t length, const TGLC_aes_key* key, unsigned char* ivec, const int enc)
 {
-    AES_ige_encrypt(in, out, length, key, ivec, enc);
+    if (key->hardware) {
+        TGLC_aes_ni_ige_encrypt(in, out, length, key, ivec, enc);
+    } else {
+        AES_ige_encrypt(in, out, length, &key->openssl_key, ivec, enc);
+    }
 }
 
 }
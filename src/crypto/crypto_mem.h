@@ -0,0 +1,38 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <openssl/crypto.h>
+
+#include <cstddef>
+
+namespace tgl {
+namespace impl {
+
+// Wipes secrets. Unlike memset() this isn't optimized away when the memory
+// is about to be freed.
+inline static void TGLC_cleanse(void* ptr, size_t len)
+{
+    OPENSSL_cleanse(ptr, len);
+}
+
+}
+}
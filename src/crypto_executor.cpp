@@ -0,0 +1,134 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "crypto_executor.h"
+
+#include "tgl/tgl_timer.h"
+
+#include <cassert>
+
+namespace tgl {
+namespace impl {
+
+// How often finished jobs are picked up while any are in flight. A 512KiB
+// file part takes about as long to encrypt.
+static constexpr double POLL_INTERVAL = 0.001;
+
+crypto_worker_pool::crypto_worker_pool(const std::shared_ptr<tgl_timer_factory>& timer_factory, size_t thread_count)
+    : m_stopping(false)
+    , m_jobs_in_flight(0)
+    , m_polling(false)
+{
+    assert(timer_factory);
+    assert(thread_count > 0);
+
+    m_poll_timer = timer_factory->create_timer([this] {
+        m_polling = false;
+        drain_finished_jobs();
+    });
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        m_threads.emplace_back(&crypto_worker_pool::run, this);
+    }
+}
+
+crypto_worker_pool::~crypto_worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (auto& thread: m_threads) {
+        thread.join();
+    }
+
+    m_poll_timer->cancel();
+    m_poll_timer.reset();
+
+    // Drop what is left on this thread without running it.
+    m_jobs.clear();
+    m_finished_jobs.clear();
+}
+
+void crypto_worker_pool::execute(std::function<void()>&& work, std::function<void()>&& done)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(job { std::move(work), std::move(done) });
+    }
+    m_condition.notify_one();
+
+    m_jobs_in_flight++;
+    if (!m_polling) {
+        m_polling = true;
+        m_poll_timer->start(POLL_INTERVAL);
+    }
+}
+
+void crypto_worker_pool::run()
+{
+    while (true) {
+        job j;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            j = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        j.work();
+
+        // Both callbacks are destroyed on the library thread, since they
+        // may hold the last reference to something which is not thread-safe.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished_jobs.push_back(std::move(j));
+    }
+}
+
+void crypto_worker_pool::drain_finished_jobs()
+{
+    std::deque<job> finished_jobs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        finished_jobs.swap(m_finished_jobs);
+    }
+
+    assert(m_jobs_in_flight >= finished_jobs.size());
+    m_jobs_in_flight -= finished_jobs.size();
+
+    for (auto& j: finished_jobs) {
+        j.done();
+    }
+    finished_jobs.clear();
+
+    // A done callback may have queued more work and started polling already.
+    if (m_jobs_in_flight && !m_polling) {
+        m_polling = true;
+        m_poll_timer->start(POLL_INTERVAL);
+    }
+}
+
+}
+}
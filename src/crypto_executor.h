@@ -0,0 +1,92 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class tgl_timer;
+class tgl_timer_factory;
+
+namespace tgl {
+namespace impl {
+
+// Runs CPU heavy crypto work (AES-IGE and SHA1 over large frames and file
+// parts) away from the thread the library is driven from.
+class crypto_executor
+{
+public:
+    virtual ~crypto_executor() { }
+
+    // Runs work on another thread and then done on the library thread.
+    // work must only touch data it owns; done is never called if the
+    // executor goes away first.
+    virtual void execute(std::function<void()>&& work, std::function<void()>&& done) = 0;
+};
+
+// A fixed number of worker threads. Finished jobs are collected on a queue
+// which a tgl_timer drains while jobs are in flight, so done callbacks run
+// on the same thread as every other timer callback and the library stays
+// single-threaded from the API user's point of view.
+class crypto_worker_pool: public crypto_executor
+{
+public:
+    crypto_worker_pool(const std::shared_ptr<tgl_timer_factory>& timer_factory, size_t thread_count);
+    virtual ~crypto_worker_pool();
+
+    crypto_worker_pool(const crypto_worker_pool&) = delete;
+    crypto_worker_pool& operator=(const crypto_worker_pool&) = delete;
+
+    virtual void execute(std::function<void()>&& work, std::function<void()>&& done) override;
+
+    size_t thread_count() const { return m_threads.size(); }
+
+private:
+    struct job
+    {
+        std::function<void()> work;
+        std::function<void()> done;
+    };
+
+    void run();
+    void drain_finished_jobs();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<job> m_jobs; // guarded by m_mutex
+    std::deque<job> m_finished_jobs; // guarded by m_mutex
+    bool m_stopping; // guarded by m_mutex
+
+    std::vector<std::thread> m_threads;
+    std::shared_ptr<tgl_timer> m_poll_timer;
+    size_t m_jobs_in_flight;
+    bool m_polling;
+};
+
+}
+}
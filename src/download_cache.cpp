@@ -0,0 +1,282 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "download_cache.h"
+
+#include "crypto/crypto_sha.h"
+#include "file_io.h"
+#include "tgl/tgl_file_location.h"
+#include "tgl/tgl_log.h"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace tgl {
+namespace impl {
+
+download_cache::download_cache(const std::string& directory)
+    : m_index_path(directory + "/download_cache.index")
+    , m_size(0)
+    , m_budget(0)
+    , m_index_dirty(false)
+{
+    load_index();
+}
+
+download_cache::~download_cache()
+{
+    save_index();
+}
+
+std::string download_cache::key(const tgl_file_location& location)
+{
+    std::ostringstream stream;
+    if (location.local_id()) {
+        stream << "v" << location.dc() << "_" << location.volume() << "_" << location.local_id();
+    } else {
+        stream << "d" << location.document_id();
+    }
+    return stream.str();
+}
+
+std::string download_cache::lookup(const tgl_file_location& location, int64_t* size)
+{
+    auto it = m_entries.find(key(location));
+    if (it == m_entries.end()) {
+        return std::string();
+    }
+
+    if (it->second.lru_position != m_lru.begin()) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru_position);
+        m_index_dirty = true;
+    }
+    if (size) {
+        *size = it->second.size;
+    }
+    return it->second.path;
+}
+
+void download_cache::remove(const tgl_file_location& location)
+{
+    remove_entry(key(location), false);
+}
+
+void download_cache::insert(const tgl_file_location& location, const std::string& path, int64_t size,
+        const std::string& content_hash)
+{
+    std::string k = key(location);
+    // Without a hash the file can't share its content with anything else.
+    std::string hash = content_hash.empty() ? "-" + k : content_hash;
+
+    auto it = m_entries.find(k);
+    if (it != m_entries.end()) {
+        remove_entry(k, it->second.path != path);
+    }
+
+    auto content_it = m_contents.find(hash);
+    if (content_it != m_contents.end() && !content_it->second.keys.empty()) {
+        const std::string& existing_path = m_entries[content_it->second.keys.front()].path;
+        if (existing_path != path) {
+            // Swap the new copy for a link to the existing one in one step, so
+            // whoever has been told about path never sees it missing.
+            std::string link_path = path + ".link";
+            boost::system::error_code ec;
+            boost::filesystem::create_hard_link(existing_path, link_path, ec);
+            if (!ec) {
+                boost::filesystem::rename(link_path, path, ec);
+            }
+            if (ec) {
+                TGL_WARNING("failed to link " << path << " to " << existing_path << ": " << ec.message());
+                boost::filesystem::remove(link_path, ec);
+                hash = "-" + k;
+            } else {
+                TGL_DEBUG("download " << path << " has the same content as " << existing_path);
+            }
+        }
+    }
+
+    add_entry(k, path, size, hash);
+    evict();
+}
+
+void download_cache::set_budget(uint64_t bytes)
+{
+    m_budget = bytes;
+    evict();
+}
+
+void download_cache::add_entry(const std::string& key, const std::string& path, int64_t size,
+        const std::string& content_hash)
+{
+    m_lru.push_front(key);
+
+    entry& e = m_entries[key];
+    e.path = path;
+    e.content_hash = content_hash;
+    e.size = size;
+    e.lru_position = m_lru.begin();
+
+    content& c = m_contents[content_hash];
+    if (c.keys.empty()) {
+        c.size = size;
+        m_size += size;
+    }
+    c.keys.push_back(key);
+
+    m_index_dirty = true;
+}
+
+void download_cache::remove_entry(const std::string& key, bool remove_file)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        return;
+    }
+
+    m_lru.erase(it->second.lru_position);
+
+    auto content_it = m_contents.find(it->second.content_hash);
+    if (content_it != m_contents.end()) {
+        auto& keys = content_it->second.keys;
+        keys.erase(std::remove(keys.begin(), keys.end(), key), keys.end());
+        if (keys.empty()) {
+            m_size -= content_it->second.size;
+            m_contents.erase(content_it);
+        }
+    }
+
+    if (remove_file) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(it->second.path, ec);
+        if (ec) {
+            TGL_WARNING("failed to remove cached file " << it->second.path << ": " << ec.message());
+        }
+    }
+
+    m_entries.erase(it);
+    m_index_dirty = true;
+}
+
+void download_cache::evict()
+{
+    // The most recently used file always stays, even if it is over the budget
+    // on its own. Removing a link only frees space once its content has no
+    // other links left.
+    while (m_budget && m_size > m_budget && m_lru.size() > 1) {
+        TGL_DEBUG("evicting " << m_lru.back() << " from the download cache");
+        remove_entry(m_lru.back(), true);
+    }
+}
+
+void download_cache::load_index()
+{
+    std::ifstream index(m_index_path);
+    if (!index) {
+        return;
+    }
+
+    // One entry per line, least recently used first: key, content hash, size
+    // and the path which takes up the rest of the line.
+    bool dropped = false;
+    std::string line;
+    while (std::getline(index, line)) {
+        std::istringstream stream(line);
+        std::string k;
+        std::string hash;
+        int64_t size = 0;
+        std::string path;
+        if (!(stream >> k >> hash >> size) || stream.get() != ' ' || !std::getline(stream, path) || path.empty()) {
+            TGL_WARNING("skipping bad download cache index line: " << line);
+            dropped = true;
+            continue;
+        }
+        boost::system::error_code ec;
+        if (!boost::filesystem::exists(path, ec)) {
+            dropped = true;
+            continue;
+        }
+        remove_entry(k, false);
+        add_entry(k, path, size, hash);
+    }
+
+    // Only entries which had to be dropped make the index worth rewriting.
+    m_index_dirty = dropped;
+}
+
+void download_cache::save_index()
+{
+    if (!m_index_dirty) {
+        return;
+    }
+
+    std::string temp_path = m_index_path + ".tmp";
+    {
+        std::ofstream index(temp_path, std::ios::trunc);
+        if (!index) {
+            TGL_WARNING("can not write download cache index " << temp_path);
+            return;
+        }
+        for (auto it = m_lru.rbegin(); it != m_lru.rend(); ++it) {
+            const entry& e = m_entries[*it];
+            index << *it << " " << e.content_hash << " " << e.size << " " << e.path << "\n";
+        }
+        if (!index.flush()) {
+            TGL_WARNING("can not write download cache index " << temp_path);
+            return;
+        }
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::rename(temp_path, m_index_path, ec);
+    if (ec) {
+        TGL_WARNING("can not replace download cache index " << m_index_path << ": " << ec.message());
+        return;
+    }
+    m_index_dirty = false;
+}
+
+std::string download_cache::hash_file(const std::string& path)
+{
+    auto file = mapped_file::open(path);
+    if (!file) {
+        return std::string();
+    }
+    return hash_data(file->data(), file->size());
+}
+
+std::string download_cache::hash_data(const unsigned char* data, size_t length)
+{
+    unsigned char digest[32];
+    TGLC_sha256(data, length, digest);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(sizeof(digest) * 2);
+    for (unsigned char c: digest) {
+        result += hex[c >> 4];
+        result += hex[c & 0xf];
+    }
+    return result;
+}
+
+}
+}
@@ -0,0 +1,105 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class tgl_file_location;
+
+namespace tgl {
+namespace impl {
+
+// Remembers which locations have been downloaded to which files. Files with
+// the same content are hard links to each other, and the least recently used
+// ones are removed once the files take up more than the budget.
+//
+// The index lives in memory, so lookups never touch the disk. It is written
+// back to a file in the download directory, least recently used entry first,
+// when the owner calls save_index() and on destruction. Changes only mark it
+// dirty, so many of them in a row cost one write.
+class download_cache
+{
+public:
+    explicit download_cache(const std::string& directory);
+    ~download_cache();
+
+    download_cache(const download_cache&) = delete;
+    download_cache& operator=(const download_cache&) = delete;
+
+    // Returns the path of the cached file and marks it as recently used, or an
+    // empty string if the location hasn't been downloaded.
+    std::string lookup(const tgl_file_location& location, int64_t* size = nullptr);
+
+    // Drops the entry of a location whose file has gone from the disk.
+    void remove(const tgl_file_location& location);
+
+    // Adds a finished download whose contents hash to content_hash.
+    void insert(const tgl_file_location& location, const std::string& path, int64_t size,
+            const std::string& content_hash);
+
+    // 0 means no limit.
+    void set_budget(uint64_t bytes);
+    uint64_t size() const { return m_size; }
+
+    // Writes the index if it has changed since it was last written.
+    void save_index();
+
+    // The hex encoded SHA-256 of the file, or an empty string if it can't be read.
+    static std::string hash_file(const std::string& path);
+    static std::string hash_data(const unsigned char* data, size_t length);
+
+private:
+    struct entry
+    {
+        std::string path;
+        std::string content_hash;
+        int64_t size = 0;
+        std::list<std::string>::iterator lru_position;
+    };
+
+    struct content
+    {
+        int64_t size = 0;
+        std::vector<std::string> keys; // of the entries linked to it
+    };
+
+    static std::string key(const tgl_file_location& location);
+
+    void add_entry(const std::string& key, const std::string& path, int64_t size, const std::string& content_hash);
+    void remove_entry(const std::string& key, bool remove_file);
+    void evict();
+    void load_index();
+
+    std::string m_index_path;
+    std::unordered_map<std::string, entry> m_entries;
+    std::unordered_map<std::string, content> m_contents; // by content hash
+    std::list<std::string> m_lru; // most recently used first
+    uint64_t m_size; // bytes of distinct content
+    uint64_t m_budget;
+    bool m_index_dirty;
+};
+
+}
+}
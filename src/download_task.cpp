@@ -22,7 +22,10 @@
 #include "download_task.h"
 
 #include "auto/constants.h"
+#include "crypto/crypto_aes.h"
 #include "crypto/crypto_md5.h"
+#include "crypto/crypto_mem.h"
+#include "file_io.h"
 
 #include <cstring>
 
@@ -32,14 +35,22 @@ namespace impl {
 download_task::download_task(int64_t id, int32_t size, const tgl_file_location& location)
     : id(id)
     , offset(0)
+    , part_size(0)
     , downloaded_bytes(0)
     , size(size)
     , type(0)
     , location(location)
     , status(tgl_download_status::waiting)
+    , parts_in_flight(0)
+    , window(1)
+    , part_latency(0)
+    , min_part_latency(0)
     , iv()
     , key()
+    , crypto_time(0)
     , decryption_offset(0)
+    , buffered_bytes(0)
+    , decrypting(false)
     , valid(true)
     , m_cancel_requested(false)
 {
@@ -48,14 +59,22 @@ download_task::download_task(int64_t id, int32_t size, const tgl_file_location&
 download_task::download_task(int64_t id, const std::shared_ptr<tgl_download_document>& document)
     : id(id)
     , offset(0)
+    , part_size(0)
     , downloaded_bytes(0)
     , size(document->size)
     , type(0)
     , location()
     , status(tgl_download_status::waiting)
+    , parts_in_flight(0)
+    , window(1)
+    , part_latency(0)
+    , min_part_latency(0)
     , iv()
     , key()
+    , crypto_time(0)
     , decryption_offset(0)
+    , buffered_bytes(0)
+    , decrypting(false)
     , valid(true)
     , m_cancel_requested(false)
 {
@@ -68,8 +87,8 @@ download_task::download_task(int64_t id, const std::shared_ptr<tgl_download_docu
 
 download_task::~download_task()
 {
-    memset(iv.data(), 0, iv.size());
-    memset(key.data(), 0, key.size());
+    TGLC_cleanse(iv.data(), iv.size());
+    TGLC_cleanse(key.data(), key.size());
 }
 
 void download_task::init_from_document(const std::shared_ptr<tgl_download_document>& document)
@@ -87,6 +106,7 @@ void download_task::init_from_document(const std::shared_ptr<tgl_download_docume
             valid = false;
             return;
         }
+        aes_key = TGLC_aes_make_key(key.data(), 256, 0);
         return;
     }
 
@@ -21,12 +21,13 @@
 
 #pragma once
 
+#include "rate_limiter.h"
 #include "tgl/tgl_file_location.h"
 #include "tgl/tgl_transfer_manager.h"
 
 #include <cstdint>
 #include <cstring>
-#include <fstream>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -36,6 +37,9 @@
 namespace tgl {
 namespace impl {
 
+struct TGLC_aes_key;
+class positional_file;
+
 class download_data {
 public:
     download_data()
@@ -43,6 +47,13 @@ public:
         , m_length(0)
     { }
 
+    // Owns length bytes of uninitialized data.
+    explicit download_data(size_t length)
+        : m_ref_data(nullptr)
+        , m_owning_data(new char[length])
+        , m_length(length)
+    { }
+
     download_data(char* data, size_t length, bool own_data)
         : m_length(length)
     {
@@ -57,6 +68,7 @@ public:
 
     char* data() const { return m_owning_data ? m_owning_data.get() : m_ref_data; }
     size_t length() const { return m_length; }
+    bool owns_data() const { return !!m_owning_data; }
     operator bool() const { return !!data() && !!length(); }
 
 private:
@@ -69,20 +81,36 @@ class download_task {
 public:
     int64_t id;
     int32_t offset;
+    int32_t part_size;
     int32_t downloaded_bytes;
     int32_t size;
     int32_t type;
-    std::unique_ptr<std::ofstream> file_stream;
+    std::unique_ptr<positional_file> file;
     tgl_file_location location;
     std::string file_name;
     std::string ext;
     tgl_download_status status;
     tgl_download_callback callback;
     std::map<size_t, download_data> running_parts;
+    size_t parts_in_flight; // requested but not answered yet
+    double window; // how many parts may be in flight, grows and shrinks with the part latency
+    double part_latency; // smoothed
+    double min_part_latency;
+    transfer_share share;
+    // Only if the hashes of the file are known: the expected SHA-256 of each
+    // part by offset, parts which didn't match it and how often that happened.
+    std::map<int32_t, std::array<unsigned char, 32>> part_hashes;
+    std::deque<int32_t> parts_to_refetch;
+    std::map<int32_t, int> part_retries;
     //encrypted documents
     std::vector<unsigned char> iv;
     std::vector<unsigned char> key;
+    std::shared_ptr<const TGLC_aes_key> aes_key; // expanded from key once per download
+    double crypto_time; // seconds spent decrypting parts
     size_t decryption_offset;
+    size_t buffered_bytes; // of parts kept in memory until they can be decrypted
+    std::map<size_t, size_t> spilled_parts; // encrypted parts put aside in the file, offset to length
+    bool decrypting; // parts are being decrypted on a crypto worker
     bool valid;
     // ---
 
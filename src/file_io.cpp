@@ -0,0 +1,167 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "file_io.h"
+
+#include "tgl/tgl_log.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tgl {
+namespace impl {
+
+std::unique_ptr<mapped_file> mapped_file::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        TGL_ERROR("can not open file [" << path << "] for reading: " << strerror(errno));
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        TGL_ERROR("can not map empty or unreadable file [" << path << "]");
+        close(fd);
+        return nullptr;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        TGL_ERROR("can not map file [" << path << "]: " << strerror(errno));
+        return nullptr;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    return std::unique_ptr<mapped_file>(new mapped_file(static_cast<const unsigned char*>(data), size));
+}
+
+mapped_file::mapped_file(const unsigned char* data, size_t size)
+    : m_data(data)
+    , m_size(size)
+{
+}
+
+mapped_file::~mapped_file()
+{
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+}
+
+void mapped_file::prefetch(size_t offset, size_t length) const
+{
+    if (offset >= m_size) {
+        return;
+    }
+    length = std::min(length, m_size - offset);
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = offset & ~(page_size - 1);
+    madvise(const_cast<unsigned char*>(m_data) + start, offset - start + length, MADV_WILLNEED);
+}
+
+std::unique_ptr<positional_file> positional_file::create(const std::string& path, int64_t size)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        TGL_ERROR("can not open file [" << path << "] for writing: " << strerror(errno));
+        return nullptr;
+    }
+
+#if defined(__linux__)
+    if (size > 0) {
+        // Only a hint to keep the file in one piece, the writes work without it.
+        int result = posix_fallocate(fd, 0, size);
+        if (result) {
+            TGL_DEBUG("failed to preallocate " << size << " bytes for [" << path << "]: " << strerror(result));
+        }
+    }
+#else
+    (void)size;
+#endif
+
+    return std::unique_ptr<positional_file>(new positional_file(fd));
+}
+
+positional_file::positional_file(int fd)
+    : m_fd(fd)
+{
+}
+
+positional_file::~positional_file()
+{
+    close(m_fd);
+}
+
+bool positional_file::write(const void* data, size_t length, int64_t offset)
+{
+    const char* p = static_cast<const char*>(data);
+    while (length) {
+        ssize_t written = pwrite(m_fd, p, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TGL_ERROR("failed to write " << length << " bytes at offset " << offset << ": " << strerror(errno));
+            return false;
+        }
+        p += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool positional_file::read(void* data, size_t length, int64_t offset)
+{
+    char* p = static_cast<char*>(data);
+    while (length) {
+        ssize_t bytes_read = pread(m_fd, p, length, offset);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            TGL_ERROR("failed to read " << length << " bytes at offset " << offset << ": "
+                    << (bytes_read ? strerror(errno) : "unexpected end of file"));
+            return false;
+        }
+        p += bytes_read;
+        length -= bytes_read;
+        offset += bytes_read;
+    }
+    return true;
+}
+
+bool positional_file::truncate(int64_t size)
+{
+    if (ftruncate(m_fd, size) != 0) {
+        TGL_ERROR("failed to truncate file to " << size << " bytes: " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+}
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace tgl {
+namespace impl {
+
+// A read-only mapping of a whole file, so uploads can serialize their parts
+// straight from it.
+class mapped_file
+{
+public:
+    // Returns nullptr if the file can't be opened or mapped, or is empty.
+    static std::unique_ptr<mapped_file> open(const std::string& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    // Asks the kernel to start reading the range without waiting for it.
+    void prefetch(size_t offset, size_t length) const;
+    size_t size() const { return m_size; }
+
+private:
+    mapped_file(const unsigned char* data, size_t size);
+
+    const unsigned char* m_data;
+    size_t m_size;
+};
+
+// A file which downloads write their parts into at the part's offset. Parts
+// can be read back, which encrypted downloads use for parts they had to put
+// aside before decrypting them.
+class positional_file
+{
+public:
+    // Creates or truncates the file and reserves size bytes for it if size is
+    // known. Returns nullptr if the file can't be created.
+    static std::unique_ptr<positional_file> create(const std::string& path, int64_t size);
+    ~positional_file();
+
+    positional_file(const positional_file&) = delete;
+    positional_file& operator=(const positional_file&) = delete;
+
+    bool write(const void* data, size_t length, int64_t offset);
+    bool read(void* data, size_t length, int64_t offset);
+    bool truncate(int64_t size);
+
+private:
+    explicit positional_file(int fd);
+
+    int m_fd;
+};
+
+}
+}
@@ -0,0 +1,90 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+
+#include "frame_buffer_pool.h"
+
+#include <algorithm>
+
+namespace tgl {
+namespace impl {
+
+constexpr size_t MAX_RETAINED_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t MAX_FREE_BUFFERS = 4;
+
+frame_buffer_pool::buffer::buffer(frame_buffer_pool& owner, size_t size)
+    : m_owner(owner)
+    , m_data(owner.acquire(size))
+    , m_size(size)
+{
+}
+
+frame_buffer_pool::buffer::~buffer()
+{
+    m_owner.release(std::move(m_data));
+}
+
+std::vector<frame_buffer_pool::block> frame_buffer_pool::acquire(size_t size)
+{
+    size_t blocks = (size + sizeof(block) - 1) / sizeof(block);
+
+    // Prefer the smallest free buffer which is large enough.
+    auto it = m_free_buffers.end();
+    for (auto candidate = m_free_buffers.begin(); candidate != m_free_buffers.end(); ++candidate) {
+        if (candidate->size() >= blocks && (it == m_free_buffers.end() || candidate->size() < it->size())) {
+            it = candidate;
+        }
+    }
+
+    std::vector<block> data;
+    if (it != m_free_buffers.end()) {
+        data = std::move(*it);
+        m_free_buffers.erase(it);
+    }
+
+    if (data.size() < blocks) {
+        data.resize(blocks);
+    }
+
+    return data;
+}
+
+void frame_buffer_pool::release(std::vector<block>&& data)
+{
+    // Don't pin the memory of an occasional huge frame.
+    if (data.size() * sizeof(block) > MAX_RETAINED_BUFFER_SIZE) {
+        return;
+    }
+
+    if (m_free_buffers.size() >= MAX_FREE_BUFFERS) {
+        auto smallest = std::min_element(m_free_buffers.begin(), m_free_buffers.end(),
+                [](const std::vector<block>& a, const std::vector<block>& b) { return a.size() < b.size(); });
+        if (smallest->size() >= data.size()) {
+            return;
+        }
+        *smallest = std::move(data);
+        return;
+    }
+
+    m_free_buffers.push_back(std::move(data));
+}
+
+}
+}
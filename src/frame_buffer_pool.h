@@ -0,0 +1,73 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+// Hands out 16-byte aligned buffers for inbound frames which can not be
+// used in place (e.g. they span several network buffers) and keeps a few
+// of them around so that steady traffic does not allocate per frame.
+class frame_buffer_pool
+{
+    struct alignas(16) block {
+        unsigned char bytes[16];
+    };
+
+public:
+    // A buffer leased from the pool, returned to it on destruction.
+    class buffer
+    {
+    public:
+        buffer(frame_buffer_pool& owner, size_t size);
+        ~buffer();
+
+        buffer(const buffer&) = delete;
+        buffer& operator=(const buffer&) = delete;
+
+        char* data() { return reinterpret_cast<char*>(m_data.data()); }
+        size_t size() const { return m_size; }
+
+    private:
+        frame_buffer_pool& m_owner;
+        std::vector<block> m_data;
+        size_t m_size;
+    };
+
+    frame_buffer_pool() = default;
+
+    frame_buffer_pool(const frame_buffer_pool&) = delete;
+    frame_buffer_pool& operator=(const frame_buffer_pool&) = delete;
+
+private:
+    std::vector<block> acquire(size_t size);
+    void release(std::vector<block>&& data);
+
+private:
+    std::vector<std::vector<block>> m_free_buffers;
+};
+
+}
+}
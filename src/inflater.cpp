@@ -0,0 +1,149 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "inflater.h"
+
+#include "tgl/tgl_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace tgl {
+namespace impl {
+
+constexpr size_t MIN_BUFFER_SIZE = 64 * 1024;
+constexpr size_t MAX_RETAINED_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t MAX_FREE_BUFFERS = 2;
+
+constexpr size_t inflater::MAX_PACKED_SIZE;
+
+inflater::buffer::buffer(inflater& owner)
+    : m_owner(owner)
+    , m_data(owner.acquire_buffer())
+    , m_size(0)
+{
+}
+
+inflater::buffer::~buffer()
+{
+    m_owner.release_buffer(std::move(m_data));
+}
+
+bool inflater::buffer::inflate(const void* input, size_t input_length)
+{
+    return m_owner.inflate(input, input_length, m_data, m_size);
+}
+
+inflater::inflater()
+    : m_stream(new z_stream)
+    , m_stream_initialized(false)
+    , m_peak_buffer_size(0)
+{
+    memset(m_stream.get(), 0, sizeof(z_stream));
+}
+
+inflater::~inflater()
+{
+    if (m_stream_initialized) {
+        inflateEnd(m_stream.get());
+    }
+}
+
+bool inflater::inflate(const void* input, size_t input_length, std::vector<int32_t>& output, size_t& output_size)
+{
+    output_size = 0;
+
+    z_stream* strm = m_stream.get();
+    if (!m_stream_initialized) {
+        if (inflateInit2(strm, 16 + MAX_WBITS) != Z_OK) {
+            TGL_ERROR("failed to call inflateInit2");
+            return false;
+        }
+        m_stream_initialized = true;
+    } else if (inflateReset(strm) != Z_OK) {
+        TGL_ERROR("failed to call inflateReset");
+        return false;
+    }
+
+    // Packed TL objects usually inflate to a few times their compressed size.
+    size_t wanted_size = std::min(std::max(input_length * 4, MIN_BUFFER_SIZE), MAX_PACKED_SIZE);
+    if (output.size() * 4 < wanted_size) {
+        output.resize(wanted_size / 4);
+    }
+
+    strm->next_in = static_cast<Bytef*>(const_cast<void*>(input));
+    strm->avail_in = input_length;
+
+    while (true) {
+        size_t capacity = output.size() * 4;
+        strm->next_out = reinterpret_cast<Bytef*>(output.data()) + output_size;
+        strm->avail_out = capacity - output_size;
+
+        int err = ::inflate(strm, Z_FINISH);
+        output_size = capacity - strm->avail_out;
+
+        if (err == Z_STREAM_END) {
+            break;
+        }
+
+        if ((err != Z_OK && err != Z_BUF_ERROR) || strm->avail_out) {
+            TGL_ERROR("inflate error = " << err << ", inflated " << output_size << " bytes");
+            output_size = 0;
+            return false;
+        }
+
+        if (capacity >= MAX_PACKED_SIZE) {
+            TGL_ERROR("inflated data is larger than " << MAX_PACKED_SIZE << " bytes");
+            output_size = 0;
+            return false;
+        }
+
+        output.resize(std::min(capacity * 2, MAX_PACKED_SIZE) / 4);
+    }
+
+    m_peak_buffer_size = std::max(m_peak_buffer_size, output.size() * 4);
+
+    return true;
+}
+
+std::vector<int32_t> inflater::acquire_buffer()
+{
+    if (m_free_buffers.empty()) {
+        return std::vector<int32_t>();
+    }
+
+    std::vector<int32_t> buffer = std::move(m_free_buffers.back());
+    m_free_buffers.pop_back();
+    return buffer;
+}
+
+void inflater::release_buffer(std::vector<int32_t>&& buffer)
+{
+    // Don't pin the memory of an occasional huge response.
+    if (buffer.size() * 4 > MAX_RETAINED_BUFFER_SIZE || m_free_buffers.size() >= MAX_FREE_BUFFERS) {
+        return;
+    }
+
+    m_free_buffers.push_back(std::move(buffer));
+}
+
+}
+}
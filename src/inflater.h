@@ -0,0 +1,90 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct z_stream_s;
+
+namespace tgl {
+namespace impl {
+
+// Inflates gzip_packed payloads with a single long-lived z_stream and a small
+// pool of output buffers which only grow when a payload needs more room.
+class inflater
+{
+public:
+    static constexpr size_t MAX_PACKED_SIZE = 1 << 24;
+
+    // An output buffer leased from the inflater. The buffer goes back
+    // to the pool when this object is destroyed. More than one buffer
+    // can be leased at the same time (e.g. a gzip_packed rpc_result
+    // inside a gzip_packed container).
+    class buffer
+    {
+    public:
+        explicit buffer(inflater& owner);
+        ~buffer();
+
+        buffer(const buffer&) = delete;
+        buffer& operator=(const buffer&) = delete;
+
+        // Returns false if the input is not a valid gzip stream or
+        // inflates to more than MAX_PACKED_SIZE bytes.
+        bool inflate(const void* input, size_t input_length);
+
+        const int32_t* begin() const { return m_data.data(); }
+        const int32_t* end() const { return m_data.data() + m_size / 4; }
+        size_t size() const { return m_size; }
+
+    private:
+        inflater& m_owner;
+        std::vector<int32_t> m_data;
+        size_t m_size;
+    };
+
+    inflater();
+    ~inflater();
+
+    inflater(const inflater&) = delete;
+    inflater& operator=(const inflater&) = delete;
+
+    // The largest output buffer we have needed so far, in bytes.
+    size_t peak_buffer_size() const { return m_peak_buffer_size; }
+    void reset_peak_buffer_size() { m_peak_buffer_size = 0; }
+
+private:
+    bool inflate(const void* input, size_t input_length, std::vector<int32_t>& output, size_t& output_size);
+    std::vector<int32_t> acquire_buffer();
+    void release_buffer(std::vector<int32_t>&& buffer);
+
+private:
+    std::unique_ptr<z_stream_s> m_stream;
+    bool m_stream_initialized;
+    size_t m_peak_buffer_size;
+    std::vector<std::vector<int32_t>> m_free_buffers;
+};
+
+}
+}
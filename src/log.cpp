@@ -20,22 +20,142 @@
 
 #include "tgl/tgl_log.h"
 
+#include <algorithm>
+
+std::atomic<int> g_tgl_log_threshold(-1);
+
 static tgl_log_function g_log_function;
-static tgl_log_level g_log_level = tgl_log_level::level_notice;
+static tgl_structured_log_function g_structured_log_function;
+
+// Lines usually fit in this; longer ones grow the buffer up to
+// MAX_RETAINED_LINE_CAPACITY, beyond which it is given back after the line.
+static constexpr size_t INITIAL_LINE_CAPACITY = 1024;
+static constexpr size_t MAX_RETAINED_LINE_CAPACITY = 64 * 1024;
+// Something written to a log line may log itself.
+static constexpr size_t MAX_NESTED_LINES = 4;
+
+namespace {
+
+class line_buffer: public std::streambuf
+{
+public:
+    std::string text;
+
+protected:
+    virtual int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            text.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        text.append(s, static_cast<size_t>(n));
+        return n;
+    }
+};
+
+struct log_line
+{
+    line_buffer buffer;
+    std::ostream stream;
+    const char* location = nullptr;
+    const char* function = nullptr;
+    size_t message_start = 0;
+
+    log_line() : stream(&buffer) { buffer.text.reserve(INITIAL_LINE_CAPACITY); }
+};
+
+struct thread_log_lines
+{
+    log_line lines[MAX_NESTED_LINES];
+    size_t depth = 0;
+};
+
+}
+
+static thread_local thread_log_lines t_log_lines;
 
 void tgl_init_log(const tgl_log_function& log_function, tgl_log_level level)
 {
     g_log_function = log_function;
-    g_log_level = level;
+    g_structured_log_function = nullptr;
+    g_tgl_log_threshold.store(log_function ? static_cast<int>(level) : -1, std::memory_order_relaxed);
+}
+
+void tgl_init_structured_log(const tgl_structured_log_function& log_function, tgl_log_level level)
+{
+    g_structured_log_function = log_function;
+    g_log_function = nullptr;
+    g_tgl_log_threshold.store(log_function ? static_cast<int>(level) : -1, std::memory_order_relaxed);
 }
 
 void tgl_log(const std::string& str, tgl_log_level level)
 {
-    if (level <= g_log_level && g_log_function) {
+    if (!tgl_log_enabled(level)) {
+        return;
+    }
+
+    if (g_structured_log_function) {
+        tgl_log_record record { level, "", "", str.data(), str.size() };
+        g_structured_log_function(record);
+    } else if (g_log_function) {
         g_log_function(str, level);
     }
 }
 
+std::ostream& tgl_log_begin(const char* location, const char* function)
+{
+    assert(t_log_lines.depth < MAX_NESTED_LINES);
+    size_t depth = std::min(t_log_lines.depth, MAX_NESTED_LINES - 1);
+    t_log_lines.depth++;
+
+    log_line& line = t_log_lines.lines[depth];
+    line.location = location;
+    line.function = function;
+
+    std::string& text = line.buffer.text;
+    text.clear();
+    text += '[';
+    text += location;
+    text += "] [";
+    text += function;
+    text += ']';
+    line.message_start = text.size();
+
+    // Undo whatever the previous line did to the formatting.
+    std::ostream& stream = line.stream;
+    stream.clear();
+    stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    stream.precision(6);
+    stream.width(0);
+    stream.fill(' ');
+    return stream;
+}
+
+void tgl_log_end(tgl_log_level level)
+{
+    assert(t_log_lines.depth > 0);
+    t_log_lines.depth--;
+    log_line& line = t_log_lines.lines[std::min(t_log_lines.depth, MAX_NESTED_LINES - 1)];
+    std::string& text = line.buffer.text;
+
+    if (g_structured_log_function) {
+        tgl_log_record record { level, line.location, line.function,
+                text.data() + line.message_start, text.size() - line.message_start };
+        g_structured_log_function(record);
+    } else if (g_log_function) {
+        g_log_function(text, level);
+    }
+
+    if (text.capacity() > MAX_RETAINED_LINE_CAPACITY) {
+        std::string().swap(text);
+        text.reserve(INITIAL_LINE_CAPACITY);
+    }
+}
+
 #if defined(__SIZEOF_INT128__)
 std::ostream& operator<<(std::ostream& s, __int128 i)
 {
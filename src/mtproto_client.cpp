@@ -30,6 +30,9 @@
 #include "crypto/crypto_rand.h"
 #include "crypto/crypto_rsa_pem.h"
 #include "crypto/crypto_sha.h"
+#include "crypto_executor.h"
+#include "frame_buffer_pool.h"
+#include "inflater.h"
 #include "mtproto_common.h"
 #include "mtproto_utils.h"
 #include "query/query_bind_temp_auth_key.h"
@@ -37,6 +40,7 @@
 #include "query/query_help_get_config.h"
 #include "rsa_public_key.h"
 #include "tools.h"
+#include "trace.h"
 #include "tgl/tgl_log.h"
 #include "tgl/tgl_net.h"
 #include "tgl/tgl_timer.h"
@@ -45,6 +49,7 @@
 #include "user_agent.h"
 
 #include <algorithm>
+#include <array>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -63,8 +68,11 @@ namespace impl {
 static constexpr double SESSION_CLEANUP_TIMEOUT = 5.0;
 static constexpr int MAX_MESSAGE_INTS = 1048576;
 static constexpr int ACK_TIMEOUT = 1;
-static constexpr size_t MAX_SECONDARY_WORKERS_PER_SESSION = 3;
 static constexpr double MAX_SECONDARY_WORKER_IDLE_TIME = 15.0;
+static constexpr size_t MAX_CONTAINER_MESSAGES = 1020;
+static constexpr size_t CONTAINER_MESSAGE_HEADER_SIZE = 16; // msg_id, seq_no and length
+// Seconds after which a sent container can't be named by the server anymore.
+static constexpr int64_t MAX_CONTAINER_AGE = 300;
 
 #pragma pack(push,4)
 struct encrypted_message {
@@ -166,6 +174,9 @@ bool mtproto_client::try_rpc_execute(const std::shared_ptr<tgl_connection>& c)
     assert(c);
 
     while (true) {
+        if (m_decrypting_connections.count(c.get())) {
+            return true;
+        }
         if (c->available_bytes_for_read() < 1) {
             return true;
         }
@@ -429,7 +440,7 @@ void mtproto_client::send_dh_params(TGLC_bn_ctx* ctx, TGLC_bn* dh_prime, TGLC_bn
 bool mtproto_client::process_respq_answer(const char* packet, int len, bool temp_key)
 {
     assert(!(len & 3));
-    tgl_in_buffer in;
+    tgl_in_buffer in = { nullptr, nullptr };
     in.ptr = reinterpret_cast<const int*>(packet);
     in.end = in.ptr + (len / 4);
     if (check_unauthorized_header(&in) < 0) {
@@ -487,7 +498,7 @@ bool mtproto_client::process_respq_answer(const char* packet, int len, bool temp
 bool mtproto_client::process_dh_answer(const char* packet, int len, bool temp_key)
 {
     assert(!(len & 3));
-    tgl_in_buffer in;
+    tgl_in_buffer in = { nullptr, nullptr };
     in.ptr = reinterpret_cast<const int*>(packet);
     in.end = in.ptr + (len / 4);
     if (check_unauthorized_header(&in) < 0) {
@@ -625,7 +636,7 @@ void mtproto_client::restart_authorization(bool temp_key)
 bool mtproto_client::process_auth_complete(const char* packet, int len, bool temp_key)
 {
     assert(!(len & 3));
-    tgl_in_buffer in;
+    tgl_in_buffer in = { nullptr, nullptr };
     in.ptr = reinterpret_cast<const int*>(packet);
     in.end = in.ptr + (len / 4);
     if (check_unauthorized_header(&in) < 0) {
@@ -789,7 +800,19 @@ int64_t mtproto_client::generate_next_msg_id()
     return next_id;
 }
 
-void mtproto_client::init_enc_msg(encrypted_message& enc_msg, bool useful)
+int32_t mtproto_client::next_seq_no(bool useful)
+{
+    assert(m_session);
+
+    int32_t seq_no = m_session->seq_no;
+    if (useful) {
+        seq_no |= 1;
+    }
+    m_session->seq_no += 2;
+    return seq_no;
+}
+
+void mtproto_client::init_enc_msg(encrypted_message& enc_msg, int64_t msg_id, int32_t seq_no)
 {
     assert(m_state == state::authorized);
     assert(m_temp_auth_key_id);
@@ -801,14 +824,8 @@ void mtproto_client::init_enc_msg(encrypted_message& enc_msg, bool useful)
         tgl_secure_random(reinterpret_cast<unsigned char*>(&m_session->session_id), 8);
     }
     enc_msg.session_id = m_session->session_id;
-    if (!enc_msg.msg_id) {
-        enc_msg.msg_id = generate_next_msg_id();
-    }
-    enc_msg.seq_no = m_session->seq_no;
-    if (useful) {
-        enc_msg.seq_no |= 1;
-    }
-    m_session->seq_no += 2;
+    enc_msg.msg_id = msg_id;
+    enc_msg.seq_no = seq_no;
 };
 
 void mtproto_client::init_enc_msg_inner_temp(encrypted_message& enc_msg, int64_t msg_id)
@@ -851,7 +868,7 @@ static std::unique_ptr<char[]> allocate_encrypted_message_buffer(int msg_ints)
 
 int64_t mtproto_client::send_message_impl(
         const int32_t* msg, size_t msg_ints, int64_t msg_id_override,
-        bool force_send, bool useful, bool allow_secondary_connections, bool count_work_load)
+        bool force_send, bool useful, bool allow_secondary_connections, bool count_work_load, bool flush_now)
 {
     if (!m_session || !m_session->primary_worker) {
         TGL_ERROR("there is no session or primary connection");
@@ -879,27 +896,244 @@ int64_t mtproto_client::send_message_impl(
         return -1;
     }
 
+    if (m_state != state::authorized || !m_temp_auth_key_id) {
+        TGL_ERROR("DC " << m_id << " is not authorized in state " << m_state);
+        return -1;
+    }
+
+    // The msg_id and seq_no are assigned right away even if the message
+    // is only sent later inside a container.
+    int64_t msg_id = msg_id_override ? msg_id_override : generate_next_msg_id();
+    int32_t seq_no = next_seq_no(useful);
+
+    if (count_work_load) {
+        best_worker->work_load.insert(msg_id);
+    }
+
+    trace_event(tgl_trace_event_type::message_queued, m_id, msg_id, msg_ints * 4);
+    queue_message(best_worker, msg, msg_ints, msg_id, seq_no);
+    if (flush_now) {
+        flush_outbound_queue(best_worker);
+    }
+
+    return msg_id;
+}
+
+void mtproto_client::queue_message(const std::shared_ptr<worker>& w,
+        const int32_t* msg, size_t msg_ints, int64_t msg_id, int32_t seq_no)
+{
+    size_t max_batch_size = m_user_agent.max_message_batch_size();
+    size_t message_size = CONTAINER_MESSAGE_HEADER_SIZE + msg_ints * 4;
+
+    if (message_size > max_batch_size) {
+        // Too large to be worth batching, keep the order of what is already queued though.
+        flush_outbound_queue(w);
+        send_encrypted_message(w, msg, msg_ints, msg_id, seq_no);
+        return;
+    }
+
+    if (w->outbound_queue_bytes + message_size > max_batch_size || w->outbound_queue.size() >= MAX_CONTAINER_MESSAGES - 1) {
+        flush_outbound_queue(w);
+    }
+
+    outbound_message m;
+    m.msg_id = msg_id;
+    m.seq_no = seq_no;
+    m.body.assign(msg, msg + msg_ints);
+    w->outbound_queue.push_back(std::move(m));
+    w->outbound_queue_bytes += message_size;
+
+    if (m_session->flush_scheduled) {
+        return;
+    }
+
+    if (!m_session->flush_timer) {
+        std::weak_ptr<mtproto_client> weak_this(shared_from_this());
+        m_session->flush_timer = m_user_agent.timer_factory()->create_timer([weak_this] {
+            if (auto shared_this = weak_this.lock()) {
+                shared_this->flush_outbound_queues();
+            }
+        });
+    }
+    m_session->flush_scheduled = true;
+    m_session->flush_timer->start(m_user_agent.max_message_batch_delay());
+}
+
+void mtproto_client::flush_outbound_queues()
+{
+    if (!m_session) {
+        return;
+    }
+
+    m_session->flush_scheduled = false;
+
+    // Make a copy since writing to a connection may end up changing the session.
+    std::vector<std::shared_ptr<worker>> workers(m_session->secondary_workers.begin(), m_session->secondary_workers.end());
+    if (m_session->primary_worker) {
+        workers.insert(workers.begin(), m_session->primary_worker);
+    }
+
+    for (const auto& w: workers) {
+        if (!m_session) {
+            return;
+        }
+        flush_outbound_queue(w);
+    }
+}
+
+void mtproto_client::flush_outbound_queue(const std::shared_ptr<worker>& w)
+{
+    if (w->outbound_queue.empty()) {
+        return;
+    }
+
+    std::vector<outbound_message> queue;
+    queue.swap(w->outbound_queue);
+    w->outbound_queue_bytes = 0;
+
+    // We were authorized and connected when the messages were queued. If that
+    // has changed since, their queries are restarted as after a bad server
+    // salt. They either wait until we are ready again or fail right away,
+    // instead of sitting until they time out.
+    bool authorized = m_state == state::authorized && m_temp_auth_key_id;
+    if (!authorized || !w->connection || w->connection->status() == tgl_connection_status::disconnected) {
+        if (authorized) {
+            TGL_WARNING("can not send " << queue.size() << " queued messages to DC " << m_id << " since the connection has been stopped");
+        } else {
+            TGL_WARNING("can not send " << queue.size() << " queued messages to DC " << m_id << " in state " << m_state);
+        }
+        for (const auto& m: queue) {
+            worker_job_done(m.msg_id);
+        }
+        for (const auto& m: queue) {
+            if (!m_session) {
+                return;
+            }
+            restart_query(m.msg_id);
+        }
+        return;
+    }
+
+    std::vector<int64_t> msg_ids;
+    msg_ids.reserve(queue.size());
+    for (const auto& m: queue) {
+        msg_ids.push_back(m.msg_id);
+    }
+
+    // Let pending acks ride along instead of sending them on their own.
+    if (is_configured() && !m_session->ack_set.empty()) {
+        m_session->ev->cancel();
+        outbound_message m;
+        m.msg_id = generate_next_msg_id();
+        m.seq_no = next_seq_no(false);
+        m.body = serialize_acks();
+        queue.push_back(std::move(m));
+    }
+
+    if (queue.size() == 1) {
+        const auto& m = queue.front();
+        send_encrypted_message(w, m.body.data(), m.body.size(), m.msg_id, m.seq_no);
+        return;
+    }
+
+    size_t container_ints = 2;
+    for (const auto& m: queue) {
+        container_ints += CONTAINER_MESSAGE_HEADER_SIZE / 4 + m.body.size();
+    }
+
+    std::vector<int32_t> container(container_ints);
+    int32_t* ptr = container.data();
+    *ptr++ = CODE_msg_container;
+    *ptr++ = queue.size();
+    for (const auto& m: queue) {
+        memcpy(ptr, &m.msg_id, 8);
+        ptr += 2;
+        *ptr++ = m.seq_no;
+        *ptr++ = m.body.size() * 4;
+        memcpy(ptr, m.body.data(), m.body.size() * 4);
+        ptr += m.body.size();
+    }
+    assert(ptr == container.data() + container.size());
+
+    // The container gets a msg_id greater than those of the messages in it
+    // and, being not content related, doesn't bump the seq_no.
+    int64_t container_msg_id = generate_next_msg_id();
+    TGL_DEBUG("sending " << queue.size() << " messages in container #" << container_msg_id << " to DC " << m_id);
+
+    // The server doesn't accept msg_ids this old, so nothing will name such a
+    // container anymore.
+    auto& containers = m_session->containers;
+    while (!containers.empty() && (containers.begin()->first >> 32) + MAX_CONTAINER_AGE < (container_msg_id >> 32)) {
+        take_container(containers.begin()->first);
+    }
+    for (int64_t id: msg_ids) {
+        m_session->message_containers[id] = container_msg_id;
+    }
+    containers[container_msg_id] = std::move(msg_ids);
+
+    send_encrypted_message(w, container.data(), container.size(), container_msg_id, m_session->seq_no);
+}
+
+void mtproto_client::send_encrypted_message(const std::shared_ptr<worker>& w,
+        const int32_t* msg, size_t msg_ints, int64_t msg_id, int32_t seq_no)
+{
     std::unique_ptr<char[]> buffer = allocate_encrypted_message_buffer(msg_ints);
     encrypted_message* enc_msg = reinterpret_cast<encrypted_message*>(buffer.get());
 
     memcpy(enc_msg->message, msg, msg_ints * 4);
     enc_msg->msg_len = msg_ints * 4;
 
-    enc_msg->msg_id = msg_id_override;
-    init_enc_msg(*enc_msg, useful);
-    int64_t msg_id = enc_msg->msg_id;
+    init_enc_msg(*enc_msg, msg_id, seq_no);
 
-    int l = aes_encrypt_message(m_temp_auth_key.data(), enc_msg);
-    assert(l > 0);
+    const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
 
-    if (count_work_load) {
-        best_worker->work_load.insert(msg_id);
+    class crypto_executor* executor = m_user_agent.crypto_executor(msg_ints * 4);
+    if (!executor) {
+        int l = aes_encrypt_message(m_temp_auth_key.data(), enc_msg);
+        assert(l > 0);
+        if (w->pending_writes.empty()) {
+            rpc_send_message(w->connection, enc_msg, l + UNENCSZ);
+            return;
+        }
+        // Something queued before us is still being encrypted, keep the order on the wire.
+        auto job = std::make_shared<pending_write>();
+        job->buffer = std::move(buffer);
+        job->length = l + UNENCSZ;
+        job->encrypted = true;
+        w->pending_writes.push_back(job);
+        return;
     }
 
-    const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
-    rpc_send_message(best_worker->connection, enc_msg, l + UNENCSZ);
+    auto job = std::make_shared<pending_write>();
+    job->buffer = std::move(buffer);
+    w->pending_writes.push_back(job);
 
-    return msg_id;
+    auto key = std::make_shared<std::array<unsigned char, 256>>(m_temp_auth_key);
+    std::weak_ptr<mtproto_client> weak_this(shared_from_this());
+    std::weak_ptr<worker> weak_worker(w);
+    executor->execute([job, key] {
+        int l = aes_encrypt_message(key->data(), reinterpret_cast<encrypted_message*>(job->buffer.get()));
+        assert(l > 0);
+        job->length = l + UNENCSZ;
+        memset(key->data(), 0, key->size());
+    }, [weak_this, weak_worker, job] {
+        auto shared_this = weak_this.lock();
+        auto w = weak_worker.lock();
+        if (!shared_this || !w) {
+            return;
+        }
+        job->encrypted = true;
+        shared_this->write_pending_messages(w);
+    });
+}
+
+void mtproto_client::write_pending_messages(const std::shared_ptr<worker>& w)
+{
+    while (!w->pending_writes.empty() && w->pending_writes.front()->encrypted) {
+        std::shared_ptr<pending_write> job = std::move(w->pending_writes.front());
+        w->pending_writes.pop_front();
+        rpc_send_message(w->connection, job->buffer.get(), job->length);
+    }
 }
 
 std::shared_ptr<worker> mtproto_client::select_best_worker(bool allow_secondary_workers)
@@ -907,24 +1141,24 @@ std::shared_ptr<worker> mtproto_client::select_best_worker(bool allow_secondary_
     assert(m_session);
     assert(m_session->primary_worker);
 
-    std::shared_ptr<worker> best_worker = m_session->primary_worker;
-
-    if (!allow_secondary_workers) {
-        return best_worker;
+    size_t max_secondary_workers = m_user_agent.media_connections();
+    if (!allow_secondary_workers || !max_secondary_workers) {
+        return m_session->primary_worker;
     }
 
-    auto min_work_load = best_worker->work_load.size();
+    // File transfers are kept off the primary worker so they don't hold up
+    // everything else behind their parts.
+    std::shared_ptr<worker> best_worker;
     for (const auto& w: m_session->secondary_workers) {
         if (!w->connection || w->connection->status() == tgl_connection_status::disconnected) {
             continue;
         }
-        if (w->work_load.size() < min_work_load) {
-            min_work_load = w->work_load.size();
+        if (!best_worker || w->work_load.size() < best_worker->work_load.size()) {
             best_worker = w;
         }
     }
 
-    if (best_worker->work_load.size() != 0 && m_session->secondary_workers.size() < MAX_SECONDARY_WORKERS_PER_SESSION) {
+    if ((!best_worker || best_worker->work_load.size() != 0) && m_session->secondary_workers.size() < max_secondary_workers) {
         std::weak_ptr<mtproto_client> weak_this(shared_from_this());
         auto connection = m_user_agent.connection_factory()->create_connection(
                 m_ipv4_options, m_ipv6_options, weak_this);
@@ -951,6 +1185,10 @@ std::shared_ptr<worker> mtproto_client::select_best_worker(bool allow_secondary_
         TGL_DEBUG("started a secondary worker, now we have " << m_session->secondary_workers.size() << " secondary workers");
     }
 
+    if (!best_worker) {
+        best_worker = m_session->primary_worker;
+    }
+
     if (best_worker == m_session->primary_worker) {
         TGL_DEBUG("selected the primary worker with work_load " << best_worker->work_load.size());
     } else {
@@ -1035,6 +1273,7 @@ int mtproto_client::work_new_session_created(tgl_in_buffer* in, int64_t msg_id)
 
 void mtproto_client::ack_query(int64_t msg_id)
 {
+    container_message_done(msg_id);
     std::shared_ptr<query> q = m_user_agent.get_active_query(msg_id);
     if (q) {
         q->ack();
@@ -1123,6 +1362,7 @@ int mtproto_client::work_rpc_result(tgl_in_buffer* in, int64_t msg_id)
     int64_t id = fetch_i64(in);
 
     worker_job_done(id);
+    container_message_done(id);
 
     uint32_t op = prefetch_i32(in);
     if (op == CODE_rpc_error) {
@@ -1136,20 +1376,79 @@ int mtproto_client::work_packed(tgl_in_buffer* in, int64_t msg_id)
 {
     auto result = fetch_i32(in);
     TGL_ASSERT_UNUSED(result, result == static_cast<int32_t>(CODE_gzip_packed));
-    constexpr size_t MAX_PACKED_SIZE = 1 << 24;
-    std::unique_ptr<int32_t[]> unzipped_buffer(new int32_t[MAX_PACKED_SIZE >> 2]);
 
     ssize_t l = prefetch_strlen(in);
+    if (l < 0) {
+        TGL_ERROR("bad gzip_packed message from DC " << m_id);
+        return -1;
+    }
     const char* s = fetch_str(in, l);
 
-    int total_out = tgl_inflate(s, l, unzipped_buffer.get(), MAX_PACKED_SIZE);
-    tgl_in_buffer new_in = { unzipped_buffer.get(), unzipped_buffer.get() + total_out / 4 };
+    inflater::buffer unzipped_buffer(m_user_agent.inflater());
+    if (!unzipped_buffer.inflate(s, l) || unzipped_buffer.size() < 4) {
+        TGL_ERROR("failed to inflate gzip_packed message from DC " << m_id);
+        return -1;
+    }
+
+    tgl_in_buffer new_in = { unzipped_buffer.begin(), unzipped_buffer.end() };
     int r = rpc_execute_answer(&new_in, msg_id, true);
     return r;
 }
 
+std::vector<int64_t> mtproto_client::take_container(int64_t msg_id)
+{
+    std::vector<int64_t> msg_ids;
+    if (!m_session) {
+        return msg_ids;
+    }
+
+    auto it = m_session->containers.find(msg_id);
+    if (it == m_session->containers.end()) {
+        return msg_ids;
+    }
+
+    msg_ids = std::move(it->second);
+    m_session->containers.erase(it);
+    for (int64_t id: msg_ids) {
+        m_session->message_containers.erase(id);
+    }
+    return msg_ids;
+}
+
+void mtproto_client::container_message_done(int64_t msg_id)
+{
+    if (!m_session) {
+        return;
+    }
+
+    auto it = m_session->message_containers.find(msg_id);
+    if (it == m_session->message_containers.end()) {
+        take_container(msg_id);
+        return;
+    }
+
+    auto container_it = m_session->containers.find(it->second);
+    m_session->message_containers.erase(it);
+    if (container_it != m_session->containers.end()) {
+        auto& msg_ids = container_it->second;
+        msg_ids.erase(std::remove(msg_ids.begin(), msg_ids.end(), msg_id), msg_ids.end());
+        if (msg_ids.empty()) {
+            m_session->containers.erase(container_it);
+        }
+    }
+}
+
 void mtproto_client::restart_query(int64_t msg_id)
 {
+    std::vector<int64_t> msg_ids = take_container(msg_id);
+    if (!msg_ids.empty()) {
+        TGL_DEBUG("restarting the " << msg_ids.size() << " queries of container " << msg_id);
+        for (int64_t id: msg_ids) {
+            restart_query(id);
+        }
+        return;
+    }
+
     std::shared_ptr<query> q = m_user_agent.get_active_query(msg_id);
     if (q) {
         TGL_DEBUG("restarting query " << msg_id);
@@ -1168,6 +1467,7 @@ int mtproto_client::work_bad_server_salt(tgl_in_buffer* in)
     TGL_DEBUG(" DC " << m_id << " id = " << id << " seq_no = " << seq_no
             << " error_code = " << error_code << " new_server_salt =" << new_server_salt
             << " old_server_salt = " << m_server_salt);
+    trace_event(tgl_trace_event_type::bad_server_salt, m_id, id, 0);
     m_server_salt = new_server_salt;
     restart_query(id);
     return 0;
@@ -1206,6 +1506,15 @@ static int work_new_detailed_info(tgl_in_buffer* in)
 
 void mtproto_client::regen_query(int64_t msg_id)
 {
+    std::vector<int64_t> msg_ids = take_container(msg_id);
+    if (!msg_ids.empty()) {
+        TGL_DEBUG("regen the " << msg_ids.size() << " queries of container " << msg_id);
+        for (int64_t id: msg_ids) {
+            regen_query(id);
+        }
+        return;
+    }
+
     std::shared_ptr<query> q = m_user_agent.get_active_query(msg_id);
     if (!q) {
         return;
@@ -1296,7 +1605,34 @@ void mtproto_client::restart_session()
     create_session();
 }
 
-bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
+// Decrypts the message in place and checks its length and msg_key. This is
+// also run on crypto workers, so it must not touch any client state.
+static bool decrypt_rpc_message(const TGLC_aes_key& aes_key, const unsigned char aes_iv[32], encrypted_message* enc, int len)
+{
+    const int MINSZ = offsetof(struct encrypted_message, message);
+    const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
+
+    unsigned char iv[32];
+    memcpy(iv, aes_iv, sizeof(iv));
+    int l = tgl_pad_aes_decrypt(&aes_key,
+            iv,
+            reinterpret_cast<const unsigned char*>(&enc->server_salt),
+            len - UNENCSZ,
+            reinterpret_cast<unsigned char*>(&enc->server_salt), len - UNENCSZ);
+    TGL_ASSERT_UNUSED(l, l == len - UNENCSZ);
+
+    if (!(!(enc->msg_len & 3) && enc->msg_len > 0 && enc->msg_len <= len - MINSZ && len - MINSZ - enc->msg_len <= 12)) {
+        return false;
+    }
+
+    unsigned char sha1_buffer[20];
+    memset(sha1_buffer, 0, sizeof(sha1_buffer));
+    TGLC_sha1((unsigned char *)&enc->server_salt, enc->msg_len + (MINSZ - UNENCSZ), sha1_buffer);
+    return !memcmp(&enc->msg_key, sha1_buffer + 4, 16);
+}
+
+bool mtproto_client::process_rpc_message(const std::shared_ptr<tgl_connection>& c,
+        encrypted_message* enc, int len, const std::shared_ptr<void>& frame_owner)
 {
     const int MINSZ = offsetof(struct encrypted_message, message);
     const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
@@ -1325,31 +1661,78 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
         tgl_init_aes_auth(&aes_key, aes_iv, m_auth_key.data() + 8, enc->msg_key, AES_DECRYPT);
     }
 
-    int l = tgl_pad_aes_decrypt(&aes_key,
-            aes_iv,
-            reinterpret_cast<const unsigned char*>(&enc->server_salt),
-            len - UNENCSZ,
-            reinterpret_cast<unsigned char*>(&enc->server_salt), len - UNENCSZ);
-    TGL_ASSERT_UNUSED(l, l == len - UNENCSZ);
+    // Large frames are decrypted on a crypto worker. Their bytes are kept
+    // alive by frame_owner and the connection is paused until they are done,
+    // so messages are still processed in the order they arrived.
+    class crypto_executor* executor = frame_owner ? m_user_agent.crypto_executor(len) : nullptr;
+    if (executor) {
+        struct decryption {
+            TGLC_aes_key aes_key;
+            unsigned char aes_iv[32];
+            bool ok = false;
+            ~decryption() {
+                memset(&aes_key, 0, sizeof(aes_key));
+                memset(aes_iv, 0, sizeof(aes_iv));
+            }
+        };
+        auto job = std::make_shared<decryption>();
+        job->aes_key = aes_key;
+        memcpy(job->aes_iv, aes_iv, sizeof(aes_iv));
+        memset(&aes_key, 0, sizeof(aes_key));
+        memset(aes_iv, 0, sizeof(aes_iv));
+
+        m_decrypting_connections.insert(c.get());
+        std::weak_ptr<mtproto_client> weak_this(shared_from_this());
+        std::weak_ptr<tgl_connection> weak_connection(c);
+        const tgl_connection* connection_key = c.get();
+        executor->execute([job, enc, len, frame_owner] {
+            job->ok = decrypt_rpc_message(job->aes_key, job->aes_iv, enc, len);
+        }, [weak_this, weak_connection, connection_key, job, enc, len, frame_owner] {
+            auto shared_this = weak_this.lock();
+            if (!shared_this) {
+                return;
+            }
+            shared_this->m_decrypting_connections.erase(connection_key);
+            auto c = weak_connection.lock();
+            if (!c) {
+                return;
+            }
+            if (!job->ok) {
+                TGL_WARNING("incorrect packet from server, closing connection");
+                shared_this->restart_session();
+                return;
+            }
+            shared_this->process_decrypted_rpc_message(enc, len);
+            if (!shared_this->try_rpc_execute(c)) {
+                shared_this->restart_session();
+            }
+        });
+        return true;
+    }
 
-    if (!(!(enc->msg_len & 3) && enc->msg_len > 0 && enc->msg_len <= len - MINSZ && len - MINSZ - enc->msg_len <= 12)) {
+    bool ok = decrypt_rpc_message(aes_key, aes_iv, enc, len);
+    memset(&aes_key, 0, sizeof(aes_key));
+    if (!ok) {
         TGL_WARNING("incorrect packet from server, closing connection");
         return false;
     }
+
+    process_decrypted_rpc_message(enc, len);
+    return true;
+}
+
+void mtproto_client::process_decrypted_rpc_message(encrypted_message* enc, int len)
+{
+    const int MINSZ = offsetof(struct encrypted_message, message);
+    const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
     assert(!(enc->msg_len & 3) && enc->msg_len > 0 && enc->msg_len <= len - MINSZ && len - MINSZ - enc->msg_len <= 12);
 
     if (!m_session || m_session->session_id != enc->session_id) {
         TGL_WARNING("message to wrong session, dropping");
-        return true;
+        return;
     }
 
-    unsigned char sha1_buffer[20];
-    memset(sha1_buffer, 0, sizeof(sha1_buffer));
-    TGLC_sha1((unsigned char *)&enc->server_salt, enc->msg_len + (MINSZ - UNENCSZ), sha1_buffer);
-    if (memcmp(&enc->msg_key, sha1_buffer + 4, 16)) {
-        TGL_WARNING("incorrect packet from server, closing connection");
-        return false;
-    }
+    trace_event(tgl_trace_event_type::message_received, m_id, enc->msg_id, enc->msg_len);
 
     int32_t this_server_time = enc->msg_id >> 32LL;
     if (!m_session->received_messages) {
@@ -1368,7 +1751,7 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
                 << ", server_time = " << server_time << ", time from msg_id = " << this_server_time
                 << ", now = " << static_cast<int64_t>(tgl_get_system_time()));
         restart_session();
-        return true;
+        return;
     }
     m_session->received_messages++;
 
@@ -1379,7 +1762,7 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
 
     TGL_DEBUG("received mesage id " << enc->msg_id);
 
-    assert(l >= (MINSZ - UNENCSZ) + 8);
+    assert(len - UNENCSZ >= (MINSZ - UNENCSZ) + 8);
 
     tgl_in_buffer in = { enc->message, enc->message + (enc->msg_len / 4) };
 
@@ -1390,11 +1773,10 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
 
     if (rpc_execute_answer(&in, enc->msg_id) < 0) {
         restart_session();
-        return true;
+        return;
     }
 
     assert(in.ptr == in.end);
-    return true;
 }
 
 bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int op, int len)
@@ -1407,10 +1789,24 @@ bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int o
         return true;
     }
 
-    std::unique_ptr<char[]> response(new char[len]);
     TGL_DEBUG("response of " << len << " bytes received from DC " << m_id);
-    int result = c->read(response.get(), len);
-    TGL_ASSERT_UNUSED(result, result == len);
+    trace_event(tgl_trace_event_type::frame_received, m_id, 0, len);
+
+    // Decrypt and parse the frame in place if the connection can hand it over
+    // as is, otherwise coalesce it once into an aligned buffer from the pool.
+    tgl_net_frame frame;
+    std::unique_ptr<frame_buffer_pool::buffer> coalesced_buffer;
+    if (c->read_frame(len, frame)) {
+        m_user_agent.frame_received(0);
+    } else {
+        coalesced_buffer = std::make_unique<frame_buffer_pool::buffer>(m_user_agent.frame_buffer_pool(), len);
+        int result = c->read(coalesced_buffer->data(), len);
+        TGL_ASSERT_UNUSED(result, result == len);
+        frame.data = coalesced_buffer->data();
+        frame.size = len;
+        m_user_agent.frame_received(len);
+    }
+    char* response = frame.data;
 
     state current_state = m_state;
     if (current_state != state::authorized) {
@@ -1418,17 +1814,17 @@ bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int o
     }
     switch (current_state) {
     case state::reqpq_sent:
-        return process_respq_answer(response.get()/* + 8*/, len/* - 12*/, false);
+        return process_respq_answer(response/* + 8*/, len/* - 12*/, false);
     case state::reqdh_sent:
-        return process_dh_answer(response.get()/* + 8*/, len/* - 12*/, false);
+        return process_dh_answer(response/* + 8*/, len/* - 12*/, false);
     case state::client_dh_sent:
-        return process_auth_complete(response.get()/* + 8*/, len/* - 12*/, false);
+        return process_auth_complete(response/* + 8*/, len/* - 12*/, false);
     case state::reqpq_sent_temp:
-        return process_respq_answer(response.get()/* + 8*/, len/* - 12*/, true);
+        return process_respq_answer(response/* + 8*/, len/* - 12*/, true);
     case state::reqdh_sent_temp:
-        return process_dh_answer(response.get()/* + 8*/, len/* - 12*/, true);
+        return process_dh_answer(response/* + 8*/, len/* - 12*/, true);
     case state::client_dh_sent_temp:
-        return process_auth_complete(response.get()/* + 8*/, len/* - 12*/, true);
+        return process_auth_complete(response/* + 8*/, len/* - 12*/, true);
     case state::authorized:
         if (op < 0 && op >= -999) {
             if (m_user_agent.pfs_enabled() && op == -404) {
@@ -1441,7 +1837,11 @@ bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int o
                 return false;
             }
         } else {
-            return process_rpc_message(reinterpret_cast<encrypted_message*>(response.get()/* + 8*/), len/* - 12*/);
+            std::shared_ptr<void> frame_owner;
+            if (m_user_agent.crypto_executor(len)) {
+                frame_owner = coalesced_buffer ? std::shared_ptr<void>(std::move(coalesced_buffer)) : frame.owner;
+            }
+            return process_rpc_message(c, reinterpret_cast<encrypted_message*>(response/* + 8*/), len/* - 12*/, frame_owner);
         }
     default:
         TGL_ERROR("cannot receive answer in state " << m_state);
@@ -1561,10 +1961,16 @@ void mtproto_client::configured(bool success)
 
 void mtproto_client::send_all_acks()
 {
-    if (!is_configured() || !m_session) {
+    if (!is_configured() || !m_session || m_session->ack_set.empty()) {
         return;
     }
 
+    std::vector<int32_t> acks = serialize_acks();
+    send_ack_message(acks.data(), acks.size());
+}
+
+std::vector<int32_t> mtproto_client::serialize_acks()
+{
     mtprotocol_serializer s;
     s.out_i32(CODE_msgs_ack);
     s.out_i32(CODE_vector);
@@ -1573,7 +1979,7 @@ void mtproto_client::send_all_acks()
         s.out_i64(id);
     }
     m_session->ack_set.clear();
-    send_ack_message(s.i32_data(), s.i32_size());
+    return std::vector<int32_t>(s.i32_data(), s.i32_data() + s.i32_size());
 }
 
 void mtproto_client::insert_msg_id(int64_t id)
@@ -1811,7 +2217,7 @@ void mtproto_client::transfer_auth_to_me()
 
 size_t mtproto_client::max_connections() const
 {
-    return MAX_SECONDARY_WORKERS_PER_SESSION + 1;
+    return m_user_agent.media_connections() + 1;
 }
 
 tgl_online_status mtproto_client::online_status() const
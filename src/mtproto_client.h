@@ -35,6 +35,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 class tgl_connection;
@@ -115,10 +116,13 @@ public:
 
     void create_session();
 
+    // Bulk queries go over the secondary connections. Interactive ones are
+    // written right away instead of waiting for the batch to fill up.
     int64_t send_message(const int32_t* message, size_t message_ints,
-            int64_t message_id_override, bool force_send, bool allow_secondary_connections)
+            int64_t message_id_override, bool force_send, tgl_query_class query_class)
     {
-        return send_message_impl(message, message_ints, message_id_override, force_send, true, allow_secondary_connections, true);
+        return send_message_impl(message, message_ints, message_id_override, force_send, true,
+                query_class == tgl_query_class::bulk, true, query_class == tgl_query_class::interactive && !force_send);
     }
 
     void reset_authorization();
@@ -131,6 +135,7 @@ public:
     void add_pending_query(const std::shared_ptr<query>& q);
     void remove_pending_query(const std::shared_ptr<query>& q);
     void send_pending_queries();
+    size_t pending_queries() const { return m_pending_queries.size(); }
 
     bool is_authorized() const { return m_authorized; }
     void set_authorized(bool b = true) { m_authorized = b; }
@@ -172,6 +177,7 @@ private:
     void reset_temp_authorization();
     void cleanup_timer_expired();
     void send_all_acks();
+    std::vector<int32_t> serialize_acks();
     int64_t generate_next_msg_id();
     double get_server_time();
     void create_temp_auth_key();
@@ -183,7 +189,8 @@ private:
     void send_req_dh_packet(TGLC_bn_ctx* ctx, TGLC_bn* pq, bool temp_key, int32_t temp_key_expire_time);
     void send_dh_params(TGLC_bn_ctx* ctx, TGLC_bn* dh_prime, TGLC_bn* g_a, int g, bool temp_key);
     void bind_temp_auth_key(int32_t temp_key_expire_time);
-    void init_enc_msg(encrypted_message& enc_msg, bool useful);
+    int32_t next_seq_no(bool useful);
+    void init_enc_msg(encrypted_message& enc_msg, int64_t msg_id, int32_t seq_no);
     void init_enc_msg_inner_temp(encrypted_message& enc_msg, int64_t msg_id);
     void restart_authorization(bool temp_key);
     int rpc_execute_answer(tgl_in_buffer* in, int64_t msg_id, bool in_gzip = false);
@@ -203,10 +210,17 @@ private:
     bool process_respq_answer(const char* packet, int len, bool temp_key);
     bool process_dh_answer(const char* packet, int len, bool temp_key);
     bool process_auth_complete(const char* packet, int len, bool temp_key);
-    bool process_rpc_message(encrypted_message* enc, int len);
+    bool process_rpc_message(const std::shared_ptr<tgl_connection>& c, encrypted_message* enc, int len,
+            const std::shared_ptr<void>& frame_owner);
+    void process_decrypted_rpc_message(encrypted_message* enc, int len);
+    // Both handle every message in msg_id if it is a container.
     void regen_query(int64_t msg_id);
     void restart_query(int64_t msg_id);
     void ack_query(int64_t msg_id);
+    // Forgets the container and returns the msg_ids of the messages sent in
+    // it, or nothing if msg_id isn't a container.
+    std::vector<int64_t> take_container(int64_t msg_id);
+    void container_message_done(int64_t msg_id);
 
     int64_t send_message(const int32_t* message, size_t message_ints)
     {
@@ -219,7 +233,14 @@ private:
     }
 
     int64_t send_message_impl(const int32_t* msg, size_t msg_ints,
-            int64_t msg_id_override, bool force_send, bool useful, bool allow_secondary_connections, bool count_work_load);
+            int64_t msg_id_override, bool force_send, bool useful, bool allow_secondary_connections, bool count_work_load,
+            bool flush_now = false);
+
+    void queue_message(const std::shared_ptr<worker>& w, const int32_t* msg, size_t msg_ints, int64_t msg_id, int32_t seq_no);
+    void flush_outbound_queue(const std::shared_ptr<worker>& w);
+    void flush_outbound_queues();
+    void send_encrypted_message(const std::shared_ptr<worker>& w, const int32_t* msg, size_t msg_ints, int64_t msg_id, int32_t seq_no);
+    void write_pending_messages(const std::shared_ptr<worker>& w);
 
     std::shared_ptr<worker> select_best_worker(bool allow_secondary_workers);
     void worker_job_done(int64_t id);
@@ -254,6 +275,9 @@ private:
     bool m_configured;
     bool m_bound;
     std::list<std::shared_ptr<query>> m_pending_queries;
+    // Connections whose current frame is being decrypted on a crypto worker.
+    // Their next frames stay in the connection until it is done.
+    std::unordered_set<const tgl_connection*> m_decrypting_connections;
 
     std::shared_ptr<query> m_logout_query;
     std::shared_ptr<query> m_bind_temp_auth_key_query;
@@ -253,6 +253,10 @@ private:
 struct tgl_in_buffer {
     const int32_t* ptr;
     const int32_t* end;
+    // Where a fetch_ds_* call found the input malformed and the
+    // constructor id it was decoding, if known.
+    const int32_t* error_ptr;
+    uint32_t error_magic;
 
     std::string print_buffer()
     {
@@ -264,6 +268,15 @@ struct tgl_in_buffer {
     }
 };
 
+// The innermost failure is the most useful one, so keep the first we see.
+static inline void fetch_fail(struct tgl_in_buffer* in, uint32_t magic)
+{
+    if (!in->error_ptr) {
+        in->error_ptr = in->ptr;
+        in->error_magic = magic;
+    }
+}
+
 static inline ssize_t prefetch_strlen(struct tgl_in_buffer* in)
 {
     if (in->ptr >= in->end) {
@@ -396,6 +396,30 @@ ssize_t tgl_connection_base::read(void* data_out, size_t len)
     return read_bytes;
 }
 
+bool tgl_connection_base::read_frame(size_t len, tgl_net_frame& frame)
+{
+    if (!len || len > m_available_bytes_for_read) {
+        return false;
+    }
+
+    auto buffer = m_read_buffer_queue.front();
+    if (buffer->size() < len || reinterpret_cast<uintptr_t>(buffer->data()) % 4) {
+        return false;
+    }
+
+    frame.data = buffer->data();
+    frame.size = len;
+    frame.owner = buffer;
+
+    buffer->advance(len);
+    if (buffer->empty()) {
+        m_read_buffer_queue.pop_front();
+    }
+    m_available_bytes_for_read -= len;
+
+    return true;
+}
+
 ssize_t tgl_connection_base::write(const void* data, size_t len)
 {
     if (!len) {
@@ -0,0 +1,224 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "peer_cache.h"
+
+#include "channel.h"
+#include "chat.h"
+#include "user.h"
+
+#include <cassert>
+
+namespace tgl {
+namespace impl {
+
+static constexpr size_t MIN_SLOT_BITS = 6;
+
+namespace {
+
+// FNV-1a over the fields which are not kept verbatim.
+class digest
+{
+public:
+    digest() : m_value(14695981039346656037ULL) { }
+
+    digest& add(int64_t v)
+    {
+        for (size_t i = 0; i < sizeof(v); ++i) {
+            add_byte(static_cast<uint8_t>(v >> (i * 8)));
+        }
+        return *this;
+    }
+
+    digest& add(const std::string& s)
+    {
+        add(static_cast<int64_t>(s.size()));
+        for (char c: s) {
+            add_byte(static_cast<uint8_t>(c));
+        }
+        return *this;
+    }
+
+    uint64_t value() const { return m_value; }
+
+private:
+    void add_byte(uint8_t b)
+    {
+        m_value ^= b;
+        m_value *= 1099511628211ULL;
+    }
+
+    uint64_t m_value;
+};
+
+}
+
+static bool same_location(const tgl_file_location& lhs, const tgl_file_location& rhs)
+{
+    return lhs.dc() == rhs.dc() && lhs.volume() == rhs.volume()
+            && lhs.local_id() == rhs.local_id() && lhs.secret() == rhs.secret();
+}
+
+peer_cache::peer_cache()
+    : m_slots(size_t(1) << MIN_SLOT_BITS, npos)
+    , m_slot_bits(MIN_SLOT_BITS)
+{
+}
+
+uint32_t peer_cache::update(user& u)
+{
+    const tgl_input_peer_t& id = u.id();
+    uint64_t details = digest()
+            .add(u.phone_number())
+            .add(static_cast<int64_t>(u.status().online))
+            .add(u.status().when)
+            .add(u.is_contact() | u.is_mutual_contact() << 1 | u.is_blocked() << 2 | u.is_blocked_confirmed() << 3
+                    | u.is_self() << 4 | u.is_bot() << 5 | u.is_deleted() << 6 | u.is_official() << 7)
+            .value();
+    return store(find_or_insert(tgl_peer_id_t::from_input_peer(id)), id.access_hash,
+            u.user_name(), u.first_name(), u.last_name(), u.photo_big(), u.photo_small(), details);
+}
+
+uint32_t peer_cache::update(const chat& c)
+{
+    const tgl_input_peer_t& id = c.id();
+    digest d;
+    d.add(c.date())
+        .add(c.participants_count())
+        .add(c.is_creator() | c.is_kicked() << 1 | c.is_left() << 2 | c.is_admins_enabled() << 3
+                | c.is_deactivated() << 4 | c.is_admin() << 5 | c.is_editor() << 6 | c.is_moderator() << 7
+                | c.is_verified() << 8 | c.is_mega_group() << 9 | c.is_restricted() << 10 | c.is_forbidden() << 11);
+    if (c.is_channel()) {
+        const channel& ch = static_cast<const channel&>(c);
+        d.add(ch.admins_count())
+            .add(ch.kicked_count())
+            .add(ch.is_official() | ch.is_broadcast() << 1);
+    }
+    return store(find_or_insert(tgl_peer_id_t::from_input_peer(id)), id.access_hash,
+            c.user_name(), c.title(), std::string(), c.photo_big(), c.photo_small(), d.value());
+}
+
+uint32_t peer_cache::store(peer_record& r, int64_t access_hash,
+        const std::string& user_name, const std::string& first_name, const std::string& last_name,
+        const tgl_file_location& photo_big, const tgl_file_location& photo_small, uint64_t details)
+{
+    uint32_t changes = unchanged;
+    if (r.stale) {
+        changes = details_changed | photo_changed;
+        r.stale = false;
+    }
+
+    // Some answers leave the access hash out; keep the one we know.
+    if (access_hash && access_hash != r.access_hash) {
+        r.access_hash = access_hash;
+        changes |= details_changed;
+    }
+
+    if (details != r.details || user_name != r.user_name
+            || first_name != r.first_name || last_name != r.last_name) {
+        r.details = details;
+        r.user_name = user_name;
+        r.first_name = first_name;
+        r.last_name = last_name;
+        changes |= details_changed;
+    }
+
+    if (!same_location(photo_big, r.photo_big) || !same_location(photo_small, r.photo_small)) {
+        r.photo_big = photo_big;
+        r.photo_small = photo_small;
+        changes |= photo_changed;
+    }
+
+    return changes;
+}
+
+void peer_cache::invalidate(const tgl_peer_id_t& id)
+{
+    handle h = find(id);
+    if (h != npos) {
+        m_records[h].stale = true;
+    }
+}
+
+peer_cache::handle peer_cache::find(const tgl_peer_id_t& id) const
+{
+    for (size_t slot = slot_of(id); ; slot = (slot + 1) & (m_slots.size() - 1)) {
+        handle h = m_slots[slot];
+        if (h == npos || m_records[h].id == id) {
+            return h;
+        }
+    }
+}
+
+int64_t peer_cache::access_hash(const tgl_peer_id_t& id) const
+{
+    handle h = find(id);
+    return h != npos ? m_records[h].access_hash : 0;
+}
+
+void peer_cache::clear()
+{
+    m_records.clear();
+    m_slots.assign(size_t(1) << MIN_SLOT_BITS, npos);
+    m_slot_bits = MIN_SLOT_BITS;
+}
+
+peer_record& peer_cache::find_or_insert(const tgl_peer_id_t& id)
+{
+    // Keep the table at most half full so probe sequences stay short.
+    if ((m_records.size() + 1) * 2 > m_slots.size()) {
+        grow();
+    }
+
+    size_t slot = slot_of(id);
+    for (; m_slots[slot] != npos; slot = (slot + 1) & (m_slots.size() - 1)) {
+        if (m_records[m_slots[slot]].id == id) {
+            return m_records[m_slots[slot]];
+        }
+    }
+
+    assert(m_records.size() < npos);
+    m_slots[slot] = static_cast<handle>(m_records.size());
+    m_records.emplace_back();
+    m_records.back().id = id;
+    return m_records.back();
+}
+
+size_t peer_cache::slot_of(const tgl_peer_id_t& id) const
+{
+    uint64_t key = static_cast<uint64_t>(id.peer_type) << 32 | static_cast<uint32_t>(id.peer_id);
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> (64 - m_slot_bits));
+}
+
+void peer_cache::grow()
+{
+    m_slot_bits++;
+    m_slots.assign(size_t(1) << m_slot_bits, npos);
+    for (size_t i = 0; i < m_records.size(); ++i) {
+        size_t slot = slot_of(m_records[i].id);
+        while (m_slots[slot] != npos) {
+            slot = (slot + 1) & (m_slots.size() - 1);
+        }
+        m_slots[slot] = static_cast<handle>(i);
+    }
+}
+
+}
+}
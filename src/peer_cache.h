@@ -0,0 +1,98 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "tgl/tgl_file_location.h"
+#include "tgl/tgl_peer_id.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+class chat;
+class user;
+
+struct peer_record
+{
+    tgl_peer_id_t id;
+    int64_t access_hash = 0;
+    std::string user_name;
+    std::string first_name; // the title of chats and channels
+    std::string last_name;
+    tgl_file_location photo_big;
+    tgl_file_location photo_small;
+    uint64_t details = 0; // digest of everything else reported to the client
+    bool stale = true; // the client may have been told something newer
+};
+
+// What we last told the client about each user, chat and channel. Records are
+// kept in an open-addressing table keyed by peer id and are never moved, so a
+// handle stays valid until clear().
+class peer_cache
+{
+public:
+    using handle = uint32_t;
+    static constexpr handle npos = UINT32_MAX;
+
+    enum change: uint32_t {
+        unchanged = 0,
+        details_changed = 1 << 0,
+        photo_changed = 1 << 1,
+    };
+
+    peer_cache();
+
+    // Stores the peer and returns a mask of change values telling what differs
+    // from the last time it was seen.
+    uint32_t update(user& u);
+    uint32_t update(const chat& c);
+
+    // Makes the next update report every change, for when the client has
+    // been told about the peer some other way.
+    void invalidate(const tgl_peer_id_t& id);
+
+    handle find(const tgl_peer_id_t& id) const;
+    const peer_record& get(handle h) const { return m_records[h]; }
+    int64_t access_hash(const tgl_peer_id_t& id) const;
+
+    size_t size() const { return m_records.size(); }
+    void clear();
+
+private:
+    peer_record& find_or_insert(const tgl_peer_id_t& id);
+    size_t slot_of(const tgl_peer_id_t& id) const;
+    void grow();
+    uint32_t store(peer_record& r, int64_t access_hash,
+            const std::string& user_name, const std::string& first_name, const std::string& last_name,
+            const tgl_file_location& photo_big, const tgl_file_location& photo_small, uint64_t details);
+
+    std::vector<peer_record> m_records;
+    std::vector<handle> m_slots; // indexes into m_records, npos if empty
+    size_t m_slot_bits;
+};
+
+}
+}
@@ -22,9 +22,11 @@
 #include "query.h"
 
 #include "auto/auto_fetch_ds.h"
-#include "auto/auto_free_ds.h"
-#include "auto/auto_skip.h"
+#include "inflater.h"
 #include "query_user_info.h"
+#include "tl_ds_arena.h"
+#include "tl_view.h"
+#include "trace.h"
 #include "tgl/tgl_timer.h"
 
 namespace tgl {
@@ -59,7 +61,8 @@ bool query::send()
 
     TGL_DEBUG("sending query \"" << m_name << "\" of size " << m_serializer->char_size() << " to DC " << m_client->id());
 
-    m_msg_id = m_client->send_message(m_serializer->i32_data(), m_serializer->i32_size(), m_msg_id_override, is_force(), is_file_transfer());
+    m_send_time = tgl_get_monotonic_time();
+    m_msg_id = m_client->send_message(m_serializer->i32_data(), m_serializer->i32_size(), m_msg_id_override, is_force(), query_class());
     if (m_msg_id == -1) {
         m_msg_id = 0;
         handle_error(400, "client failed to send message");
@@ -79,6 +82,8 @@ bool query::send()
 void query::alarm()
 {
     TGL_DEBUG("alarm query #" << msg_id() << " (type '" << m_name << "') to DC " << m_client->id());
+    trace_event(tgl_trace_event_type::query_resent, m_client->id(), msg_id(), m_serializer->char_size());
+    m_user_agent.query_metrics().query_retried(*this);
 
     clear_timers();
 
@@ -118,6 +123,7 @@ void query::alarm()
 
 void query::regen()
 {
+    trace_event(tgl_trace_event_type::query_regenerated, m_client->id(), msg_id(), m_serializer->char_size());
     m_ack_received = false;
     if (!is_in_the_same_session() || (!m_client->is_configured() && !is_force())) {
         m_session_id = 0;
@@ -129,12 +135,14 @@ void query::timeout_alarm()
 {
     clear_timers();
     on_timeout();
+    m_user_agent.query_metrics().query_timed_out(*this);
 
     if (!should_retry_on_timeout()) {
         if (msg_id()) {
             m_user_agent.remove_active_query(shared_from_this());
         }
         m_client->remove_pending_query(shared_from_this());
+        m_user_agent.query_finished(*this, false);
     } else {
         alarm();
     }
@@ -150,6 +158,11 @@ void query::execute(const std::shared_ptr<mtproto_client>& client, execution_opt
     assert(m_client);
     m_client->add_connection_status_observer(shared_from_this());
 
+    if (!m_execute_time) {
+        m_execute_time = tgl_get_monotonic_time();
+        m_user_agent.query_metrics().query_executed(*this);
+    }
+
     if (!check_logging_out()) {
         return;
     }
@@ -208,13 +221,13 @@ void query::out_peer_id(const tgl_peer_id_t& id, int64_t access_hash)
         } else {
             m_serializer->out_i32(CODE_input_peer_user);
             m_serializer->out_i32(id.peer_id);
-            m_serializer->out_i64(access_hash);
+            m_serializer->out_i64(access_hash ? access_hash : m_user_agent.peer_access_hash(id));
         }
         break;
     case tgl_peer_type::channel:
         m_serializer->out_i32(CODE_input_peer_channel);
         m_serializer->out_i32(id.peer_id);
-        m_serializer->out_i64(access_hash);
+        m_serializer->out_i64(access_hash ? access_hash : m_user_agent.peer_access_hash(id));
         break;
     default:
         assert(false);
@@ -289,6 +302,7 @@ int query::handle_error(int error_code, const std::string& error_string)
     if (msg_id()) {
         m_user_agent.remove_active_query(shared_from_this());
     }
+    m_user_agent.query_metrics().query_error(*this, error_code);
 
     int retry_within_seconds = 0;
     bool should_retry = false;
@@ -379,6 +393,7 @@ int query::handle_error(int error_code, const std::string& error_string)
         return 0;
     }
 
+    m_user_agent.query_finished(*this, false);
     return on_error_internal(error_code, error_string);
 }
 
@@ -492,6 +507,13 @@ void query::on_answer_internal(void* DS)
     on_answer(DS);
 }
 
+void query::on_answer_view_internal(const tl_object_view& view)
+{
+    assert(m_client);
+    m_client->remove_connection_status_observer(shared_from_this());
+    on_answer_view(view);
+}
+
 int query::on_error_internal(int error_code, const std::string& error_string)
 {
     assert(m_client);
@@ -504,54 +526,90 @@ int query::handle_result(tgl_in_buffer* in)
     int32_t op = prefetch_i32(in);
 
     tgl_in_buffer save_in = { nullptr, nullptr };
-    std::unique_ptr<int32_t[]> packed_buffer;
+    std::unique_ptr<inflater::buffer> packed_buffer;
 
     if (op == CODE_gzip_packed) {
         fetch_i32(in);
         int l = prefetch_strlen(in);
+        if (l < 0) {
+            in->ptr = in->end;
+            handle_error(600, "invaid response from the server");
+            return 0;
+        }
         const char* s = fetch_str(in, l);
 
-        constexpr size_t MAX_PACKED_SIZE = 1 << 24;
-        packed_buffer.reset(new int32_t[MAX_PACKED_SIZE / 4]);
-
-        int total_out = tgl_inflate(s, l, packed_buffer.get(), MAX_PACKED_SIZE);
-        TGL_DEBUG("inflated " << total_out << " bytes");
+        packed_buffer.reset(new inflater::buffer(m_user_agent.inflater()));
+        if (!packed_buffer->inflate(s, l)) {
+            handle_error(600, "invaid response from the server");
+            return 0;
+        }
+        TGL_DEBUG("inflated " << packed_buffer->size() << " bytes");
         save_in = *in;
-        in->ptr = packed_buffer.get();
-        in->end = in->ptr + total_out / 4;
+        in->ptr = packed_buffer->begin();
+        in->end = packed_buffer->end();
     }
 
     TGL_DEBUG("result for query #" << msg_id() << ". Size " << (long)4 * (in->end - in->ptr) << " bytes");
+    trace_event(tgl_trace_event_type::query_result, m_client->id(), msg_id(), 4 * (in->end - in->ptr));
+
+    const int32_t* start = in->ptr;
+    in->error_ptr = nullptr;
+
+    if (wants_answer_view()) {
+        tl_object_view view;
+        if (!view.index(in, &m_type) || in->ptr != in->end) {
+            TGL_ERROR("failed to decode the answer to query \"" << name() << "\" (type " << m_type.type.id << ") at offset "
+                    << 4 * (in->ptr - start) << " of " << 4 * (in->end - start) << " bytes");
+            if (save_in.ptr) {
+                *in = save_in;
+            } else {
+                in->ptr = in->end;
+            }
+            handle_error(600, "invaid response from the server");
+            return 0;
+        }
 
-    tgl_in_buffer skip_in = *in;
-    if (skip_type_any(&skip_in, &m_type) < 0) {
-        TGL_ERROR("skipped " << (long)(skip_in.ptr - in->ptr) << " int out of " << (long)(skip_in.end - in->ptr) << " (type " << m_type.type.id << ") (query type " << name() << ")");
-        TGL_ERROR("0x" << std::hex << *(in->ptr - 1) << " 0x" << *(in->ptr) << " 0x" << *(in->ptr + 1) << " 0x" << *(in->ptr + 2));
-        TGL_ERROR(in->print_buffer());
-        assert(false);
-        handle_error(600, "invaid response from the server");
+        on_answer_view_internal(view);
+        finish_answer(in, save_in);
         return 0;
     }
 
-    assert(skip_in.ptr == skip_in.end);
-
-    void* DS = fetch_ds_type_any(in, &m_type);
-    assert(DS);
+    // The fetch validates the answer as it goes, so there is no separate skip pass.
+    // The whole answer lives in the arena and goes away with it.
+    tl_ds_arena arena;
+    void* DS = fetch_ds_type_any(in, &m_type, &arena);
+    if (!DS || in->ptr != in->end) {
+        const int32_t* error_ptr = in->error_ptr ? in->error_ptr : in->ptr;
+        TGL_ERROR("failed to decode the answer to query \"" << name() << "\" (type " << m_type.type.id << ") at offset "
+                << 4 * (error_ptr - start) << " of " << 4 * (in->end - start) << " bytes, constructor 0x"
+                << std::hex << (DS ? 0 : in->error_magic));
+        if (save_in.ptr) {
+            *in = save_in;
+        } else {
+            in->ptr = in->end;
+        }
+        handle_error(600, "invaid response from the server");
+        return 0;
+    }
 
     on_answer_internal(DS);
-    free_ds_type_any(DS, &m_type);
+    finish_answer(in, save_in);
 
+    return 0;
+}
+
+void query::finish_answer(tgl_in_buffer* in, const tgl_in_buffer& save_in)
+{
     assert(in->ptr == in->end);
 
     clear_timers();
 
     m_user_agent.remove_active_query(shared_from_this());
+    m_user_agent.query_finished(*this, true);
 
     if (save_in.ptr) {
         *in = save_in;
     }
-
-    return 0;
 }
 
 void query::out_header()
@@ -26,6 +26,7 @@
 #include "mtproto_common.h"
 #include "mtproto_client.h"
 #include "tgl/tgl_connection_status.h"
+#include "tgl/tgl_net.h"
 #include "tgl/tgl_peer_id.h"
 #include "user_agent.h"
 
@@ -37,6 +38,8 @@ class tgl_timer;
 namespace tgl {
 namespace impl {
 
+class tl_object_view;
+
 class query: public std::enable_shared_from_this<query>, public mtproto_client::connection_status_observer
 {
 public:
@@ -51,6 +54,8 @@ public:
         , m_exec_option(execution_option::UNKNOWN)
         , m_connection_status(tgl_connection_status::disconnected)
         , m_ack_received(false)
+        , m_send_time(0)
+        , m_execute_time(0)
         , m_name(name)
         , m_type(type)
         , m_serializer(std::make_shared<mtprotocol_serializer>())
@@ -124,6 +129,10 @@ public:
     const std::shared_ptr<mtproto_client>& client() const { return m_client; }
 
     virtual void on_answer(void* DS) = 0;
+    // Only query_with_view returns true here, its answer goes to
+    // on_answer_view() instead of on_answer().
+    virtual bool wants_answer_view() const { return false; }
+    virtual void on_answer_view(const tl_object_view& view) { }
     virtual int on_error(int error_code, const std::string& error_string) = 0;
     virtual void on_timeout() { }
     virtual void on_connection_status_changed(tgl_connection_status status) { }
@@ -132,12 +141,19 @@ public:
     virtual bool should_retry_on_timeout() const { return true; }
     virtual bool should_retry_after_recover_from_error() const { return true; }
     virtual bool is_file_transfer() const { return false; }
+    // Decides the connection the query goes over and how soon it's written to it.
+    virtual tgl_query_class query_class() const
+    {
+        return is_file_transfer() ? tgl_query_class::bulk : tgl_query_class::interactive;
+    }
 
     virtual void will_be_pending() { }
     virtual void will_send() { }
     virtual void sent() { }
 
     bool ack_received() const { return m_ack_received; }
+    double send_time() const { return m_send_time; }
+    double execute_time() const { return m_execute_time; }
     void clear_timers();
 
 protected:
@@ -156,6 +172,8 @@ private:
     bool is_in_the_same_session() const;
     bool send();
     void on_answer_internal(void* DS);
+    void on_answer_view_internal(const tl_object_view& view);
+    void finish_answer(tgl_in_buffer* in, const tgl_in_buffer& save_in);
     int on_error_internal(int error_code, const std::string& error_string);
 
 protected:
@@ -169,6 +187,8 @@ private:
     execution_option m_exec_option;
     tgl_connection_status m_connection_status;
     bool m_ack_received;
+    double m_send_time;
+    double m_execute_time; // the first one, the query may be executed again on another DC
     const std::string m_name;
     paramed_type m_type;
     std::shared_ptr<mtprotocol_serializer> m_serializer;
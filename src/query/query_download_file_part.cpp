@@ -86,7 +86,8 @@ void query_download_file_part::will_send()
 
 bool query_download_file_part::download_finished() const
 {
-    return m_download->status == tgl_download_status::succeeded
+    return !m_download
+            || m_download->status == tgl_download_status::succeeded
             || m_download->status == tgl_download_status::failed
             || m_download->status == tgl_download_status::cancelled;
 }
@@ -29,6 +29,8 @@ namespace impl {
 class download_task;
 struct tl_ds_upload_file;
 
+// download is null for the parts of a batch download, which don't have a
+// status of their own.
 class query_download_file_part: public query
 {
 public:
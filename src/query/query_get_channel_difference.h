@@ -36,6 +36,7 @@ class query_get_channel_difference: public query
 public:
     query_get_channel_difference(user_agent& ua, const std::shared_ptr<channel>& c,
             const std::function<void(bool)>& callback);
+    virtual tgl_query_class query_class() const override { return tgl_query_class::background; }
     virtual void on_answer(void* D) override;
     virtual int on_error(int error_code, const std::string& error_string) override;
 
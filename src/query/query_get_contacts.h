@@ -21,7 +21,7 @@
 
 #pragma once
 
-#include "query.h"
+#include "query_with_view.h"
 #include "tgl/tgl_log.h"
 #include "user.h"
 
@@ -32,24 +32,30 @@
 namespace tgl {
 namespace impl {
 
-class query_get_contacts: public query
+class query_get_contacts: public query_with_view
 {
 public:
     query_get_contacts(user_agent& ua,
             const std::function<void(bool, const std::vector<std::shared_ptr<tgl_user>>&)>& callback)
-        : query(ua, "get contacts", TYPE_TO_PARAM(contacts_contacts))
+        : query_with_view(ua, "get contacts", TYPE_TO_PARAM(contacts_contacts))
         , m_callback(callback)
     { }
 
-    virtual void on_answer(void* D) override
+    virtual tgl_query_class query_class() const override { return tgl_query_class::background; }
+
+    virtual void on_answer_view(const tl_object_view& view) override
     {
-        tl_ds_contacts_contacts* DS_CC = static_cast<tl_ds_contacts_contacts*>(D);
-        int32_t n = DS_CC->users ? DS_LVAL(DS_CC->users->cnt) : 0;
         std::vector<std::shared_ptr<tgl_user>> users;
-        for (int32_t i = 0; i < n; ++i) {
-            if (auto u = user::create(DS_CC->users->data[i])) {
-                m_user_agent.user_fetched(u);
-            }
+        paramed_type user_type = TYPE_TO_PARAM(user);
+        tl_vector_view users_view;
+        if (users_view.index(view.field(view_field_contacts_contacts_users(view.magic())), &user_type)) {
+            users.reserve(users_view.size());
+            users_view.for_each<tl_ds_user>([&](const tl_ds_user* DS_U) {
+                if (auto u = user::create(DS_U)) {
+                    m_user_agent.user_fetched(u);
+                    users.push_back(u);
+                }
+            });
         }
         if (m_callback) {
             m_callback(true, users);
@@ -54,6 +54,7 @@ class query_get_dialogs: public query
 public:
     query_get_dialogs(user_agent& ua, const std::shared_ptr<get_dialogs_state>& state,
             const std::function<void(bool, const std::vector<tgl_peer_id_t>&, const std::vector<int64_t>&, const std::vector<int>&)>& callback);
+    virtual tgl_query_class query_class() const override { return tgl_query_class::background; }
     virtual void on_answer(void* D) override;
     virtual int on_error(int error_code, const std::string& error_string) override;
 
@@ -24,6 +24,7 @@
 #include "chat.h"
 #include "message.h"
 #include "tgl/tgl_update_callback.h"
+#include "tl_view.h"
 #include "updater.h"
 #include "user.h"
 
@@ -31,70 +32,93 @@ namespace tgl {
 namespace impl {
 
 query_get_difference::query_get_difference(user_agent& ua, const std::function<void(bool)>& callback)
-    : query(ua, "get difference", TYPE_TO_PARAM(updates_difference))
+    : query_with_view(ua, "get difference", TYPE_TO_PARAM(updates_difference))
     , m_callback(callback)
 { }
 
-void query_get_difference::on_answer(void* D)
+void query_get_difference::on_answer_view(const tl_object_view& view)
 {
     TGL_DEBUG("get difference answer");
 
-    const tl_ds_updates_difference* DS_UD = static_cast<const tl_ds_updates_difference*>(D);
+    uint32_t magic = view.magic();
 
     assert(m_user_agent.is_diff_locked());
     m_user_agent.set_diff_locked(false);
 
-    if (DS_UD->magic == CODE_updates_difference_empty) {
-        m_user_agent.set_date(DS_LVAL(DS_UD->date));
-        m_user_agent.set_seq(DS_LVAL(DS_UD->seq));
+    if (magic == CODE_updates_difference_empty) {
+        m_user_agent.set_date(view.field_i32(view_field_updates_difference_date(magic)));
+        m_user_agent.set_seq(view.field_i32(view_field_updates_difference_seq(magic)));
         TGL_DEBUG("empty difference, seq = " << m_user_agent.seq());
         if (m_callback) {
             m_callback(true);
         }
     } else {
-        int32_t n = DS_LVAL(DS_UD->users->cnt);
-        for (int32_t i = 0; i < n; ++i) {
-            if (auto u = user::create(DS_UD->users->data[i])) {
-                m_user_agent.user_fetched(u);
-            }
+        paramed_type user_type = TYPE_TO_PARAM(user);
+        tl_vector_view users;
+        if (users.index(view.field(view_field_updates_difference_users(magic)), &user_type)) {
+            users.for_each<tl_ds_user>([this](const tl_ds_user* DS_U) {
+                if (auto u = user::create(DS_U)) {
+                    m_user_agent.user_fetched(u);
+                }
+            });
         }
 
-        n = DS_LVAL(DS_UD->chats->cnt);
-        for (int32_t i = 0; i < n; ++i) {
-            if (auto c = chat::create(DS_UD->chats->data[i])) {
-                m_user_agent.chat_fetched(c);
-            }
+        paramed_type chat_type = TYPE_TO_PARAM(chat);
+        tl_vector_view chats;
+        if (chats.index(view.field(view_field_updates_difference_chats(magic)), &chat_type)) {
+            chats.for_each<tl_ds_chat>([this](const tl_ds_chat* DS_C) {
+                if (auto c = chat::create(DS_C)) {
+                    m_user_agent.chat_fetched(c);
+                }
+            });
         }
 
-        n = DS_LVAL(DS_UD->other_updates->cnt);
-        for (int32_t i = 0; i < n; ++i) {
-            m_user_agent.updater().work_update(DS_UD->other_updates->data[i], update_context(update_mode::dont_check_and_update_consistency));
+        paramed_type update_type = TYPE_TO_PARAM(update);
+        tl_vector_view other_updates;
+        if (other_updates.index(view.field(view_field_updates_difference_other_updates(magic)), &update_type)) {
+            other_updates.for_each<tl_ds_update>([this](const tl_ds_update* DS_U) {
+                m_user_agent.updater().work_update(DS_U, update_context(update_mode::dont_check_and_update_consistency));
+            });
         }
 
-        int32_t message_count = DS_LVAL(DS_UD->new_messages->cnt);
+        paramed_type message_type = TYPE_TO_PARAM(message);
+        tl_vector_view new_messages;
         std::vector<std::shared_ptr<tgl_message>> messages;
-        for (int32_t i = 0; i < message_count; ++i) {
-            if (auto m = message::create(m_user_agent.our_id(), DS_UD->new_messages->data[i])) {
-                messages.push_back(m);
-            }
+        if (new_messages.index(view.field(view_field_updates_difference_new_messages(magic)), &message_type)) {
+            messages.reserve(new_messages.size());
+            new_messages.for_each<tl_ds_message>([&](const tl_ds_message* DS_M) {
+                if (auto m = message::create(m_user_agent.our_id(), DS_M)) {
+                    messages.push_back(m);
+                }
+            });
         }
         m_user_agent.callback()->new_messages(messages);
         messages.clear();
 
-        int32_t encrypted_message_count = DS_LVAL(DS_UD->new_encrypted_messages->cnt);
-        for (int32_t i = 0; i < encrypted_message_count; ++i) {
-            m_user_agent.updater().work_encrypted_message(DS_UD->new_encrypted_messages->data[i]);
+        paramed_type encrypted_message_type = TYPE_TO_PARAM(encrypted_message);
+        tl_vector_view new_encrypted_messages;
+        if (new_encrypted_messages.index(view.field(view_field_updates_difference_new_encrypted_messages(magic)), &encrypted_message_type)) {
+            new_encrypted_messages.for_each<tl_ds_encrypted_message>([this](const tl_ds_encrypted_message* DS_EM) {
+                m_user_agent.updater().work_encrypted_message(DS_EM);
+            });
         }
 
-        if (DS_UD->state) {
-            m_user_agent.set_pts(DS_LVAL(DS_UD->state->pts));
-            m_user_agent.set_qts(DS_LVAL(DS_UD->state->qts));
-            m_user_agent.set_date(DS_LVAL(DS_UD->state->date));
-            m_user_agent.set_seq(DS_LVAL(DS_UD->state->seq));
+        tl_ds_arena arena;
+        paramed_type state_type = TYPE_TO_PARAM(updates_state);
+        int state_field = view_field_updates_difference_state(magic);
+        if (view.has_field(state_field)) {
+            tgl_in_buffer in = view.field(state_field);
+            const tl_ds_updates_state* DS_US = fetch_ds_type_updates_state(&in, &state_type, &arena);
+            m_user_agent.set_pts(DS_LVAL(DS_US->pts));
+            m_user_agent.set_qts(DS_LVAL(DS_US->qts));
+            m_user_agent.set_date(DS_LVAL(DS_US->date));
+            m_user_agent.set_seq(DS_LVAL(DS_US->seq));
         } else {
-            m_user_agent.set_pts(DS_LVAL(DS_UD->intermediate_state->pts));
-            m_user_agent.set_qts(DS_LVAL(DS_UD->intermediate_state->qts));
-            m_user_agent.set_date(DS_LVAL(DS_UD->intermediate_state->date));
+            tgl_in_buffer in = view.field(view_field_updates_difference_intermediate_state(magic));
+            const tl_ds_updates_state* DS_US = fetch_ds_type_updates_state(&in, &state_type, &arena);
+            m_user_agent.set_pts(DS_LVAL(DS_US->pts));
+            m_user_agent.set_qts(DS_LVAL(DS_US->qts));
+            m_user_agent.set_date(DS_LVAL(DS_US->date));
             m_user_agent.get_difference(false, m_callback);
             return;
         }
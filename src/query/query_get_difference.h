@@ -21,7 +21,7 @@
 
 #pragma once
 
-#include "query.h"
+#include "query_with_view.h"
 #include "tgl/tgl_log.h"
 
 #include <functional>
@@ -30,11 +30,12 @@
 namespace tgl {
 namespace impl {
 
-class query_get_difference: public query
+class query_get_difference: public query_with_view
 {
 public:
     query_get_difference(user_agent& ua, const std::function<void(bool)>& callback);
-    virtual void on_answer(void* D) override;
+    virtual tgl_query_class query_class() const override { return tgl_query_class::background; }
+    virtual void on_answer_view(const tl_object_view& view) override;
     virtual int on_error(int error_code, const std::string& error_string) override;
 
 private:
@@ -24,6 +24,7 @@
 #include "chat.h"
 #include "message.h"
 #include "tgl/tgl_update_callback.h"
+#include "tl_view.h"
 #include "user.h"
 
 namespace tgl {
@@ -31,7 +32,7 @@ namespace impl {
 
 query_get_history::query_get_history(user_agent& ua, const tgl_input_peer_t& id, int limit, int offset, int max_id,
         const std::function<void(bool, const std::vector<std::shared_ptr<tgl_message>>&)>& callback)
-    : query(ua, "get history", TYPE_TO_PARAM(messages_messages))
+    : query_with_view(ua, "get history", TYPE_TO_PARAM(messages_messages))
     , m_id(id)
 #if 0
     , m_limit(limit)
@@ -41,37 +42,49 @@ query_get_history::query_get_history(user_agent& ua, const tgl_input_peer_t& id,
     , m_callback(callback)
 { }
 
-void query_get_history::on_answer(void* D)
+void query_get_history::on_answer_view(const tl_object_view& view)
 {
     TGL_DEBUG("get history on answer for query #" << msg_id());
-    const tl_ds_messages_messages* DS_MM = static_cast<const tl_ds_messages_messages*>(D);
-
-    int32_t n = DS_LVAL(DS_MM->chats->cnt);
-    for (int32_t i = 0; i < n; ++i) {
-        if (auto c = chat::create(DS_MM->chats->data[i])) {
-            m_user_agent.chat_fetched(c);
-        }
+    uint32_t magic = view.magic();
+
+    paramed_type chat_type = TYPE_TO_PARAM(chat);
+    tl_vector_view chats;
+    if (chats.index(view.field(view_field_messages_messages_chats(magic)), &chat_type)) {
+        chats.for_each<tl_ds_chat>([this](const tl_ds_chat* DS_C) {
+            if (auto c = chat::create(DS_C)) {
+                m_user_agent.chat_fetched(c);
+            }
+        });
     }
-    n = DS_LVAL(DS_MM->users->cnt);
-    for (int32_t i = 0; i < n; ++i) {
-        if (auto u = user::create(DS_MM->users->data[i])) {
-            m_user_agent.user_fetched(u);
-        }
+
+    paramed_type user_type = TYPE_TO_PARAM(user);
+    tl_vector_view users;
+    if (users.index(view.field(view_field_messages_messages_users(magic)), &user_type)) {
+        users.for_each<tl_ds_user>([this](const tl_ds_user* DS_U) {
+            if (auto u = user::create(DS_U)) {
+                m_user_agent.user_fetched(u);
+            }
+        });
     }
-    n = DS_LVAL(DS_MM->messages->cnt);
-    for (int32_t i = 0; i < n; ++i) {
-        if (auto m = message::create(m_user_agent.our_id(), DS_MM->messages->data[i])) {
-            m->set_history(true);
-            m_messages.push_back(m);
-        }
+
+    paramed_type message_type = TYPE_TO_PARAM(message);
+    tl_vector_view messages;
+    if (messages.index(view.field(view_field_messages_messages_messages(magic)), &message_type)) {
+        m_messages.reserve(messages.size());
+        messages.for_each<tl_ds_message>([this](const tl_ds_message* DS_M) {
+            if (auto m = message::create(m_user_agent.our_id(), DS_M)) {
+                m->set_history(true);
+                m_messages.push_back(m);
+            }
+        });
     }
     m_user_agent.callback()->new_messages(m_messages);
 
 #if 0
-    m_offset += n;
-    m_limit -= n;
+    m_offset += messages.size();
+    m_limit -= messages.size();
 
-    int count = DS_LVAL(DS_MM->count);
+    int count = view.field_i32(view_field_messages_messages_count(magic));
     if (count >= 0 && m_limit + m_offset >= count) {
         m_limit = count - m_offset;
         if (m_limit < 0) {
@@ -86,7 +99,7 @@ void query_get_history::on_answer(void* D)
     }
 
 #if 0
-    if (m_limit <= 0 || DS_MM->magic == CODE_messages_messages || DS_MM->magic == CODE_messages_channel_messages) {
+    if (m_limit <= 0 || magic == CODE_messages_messages || magic == CODE_messages_channel_messages) {
 
         /*if (m_messages.size() > 0) {
           tgl_do_messages_mark_read(m_id, m_messages[0]->id, 0, 0, 0);
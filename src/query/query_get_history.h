@@ -21,7 +21,7 @@
 
 #pragma once
 
-#include "query.h"
+#include "query_with_view.h"
 #include "tgl/tgl_log.h"
 #include "tgl/tgl_message.h"
 
@@ -33,12 +33,12 @@
 namespace tgl {
 namespace impl {
 
-class query_get_history: public query
+class query_get_history: public query_with_view
 {
 public:
     query_get_history(user_agent& ua, const tgl_input_peer_t& id, int limit, int offset, int max_id,
             const std::function<void(bool, const std::vector<std::shared_ptr<tgl_message>>&)>& callback);
-    virtual void on_answer(void* D) override;
+    virtual void on_answer_view(const tl_object_view& view) override;
     virtual int on_error(int error_code, const std::string& error_string) override;
 
 private:
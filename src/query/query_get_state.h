@@ -38,6 +38,8 @@ public:
         , m_callback(callback)
     { }
 
+    virtual tgl_query_class query_class() const override { return tgl_query_class::background; }
+
     virtual void on_answer(void* D) override
     {
         assert(m_user_agent.is_diff_locked());
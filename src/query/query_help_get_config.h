@@ -30,6 +30,7 @@ class query_help_get_config: public query
 {
 public:
     query_help_get_config(user_agent& ua, const std::function<void(bool)>& callback);
+    virtual tgl_query_class query_class() const override { return tgl_query_class::background; }
     virtual void on_answer(void* DS) override;
     virtual int on_error(int error_code, const std::string& error_string) override;
     virtual double timeout_interval() const override;
@@ -0,0 +1,47 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "query.h"
+#include "tl_view.h"
+
+#include <string>
+
+namespace tgl {
+namespace impl {
+
+// A query with a large answer of which only some fields are needed. The
+// answer is validated and handed to on_answer_view() as a zero-copy view
+// instead of being fetched as a whole.
+class query_with_view: public query
+{
+public:
+    query_with_view(user_agent& ua, const std::string& name, const paramed_type& type)
+        : query(ua, name, type)
+    { }
+
+    virtual bool wants_answer_view() const override final { return true; }
+    virtual void on_answer(void*) override final { }
+    virtual void on_answer_view(const tl_object_view& view) override = 0;
+};
+
+}
+}
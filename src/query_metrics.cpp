@@ -0,0 +1,83 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "query_metrics.h"
+
+#include "mtproto_client.h"
+#include "query/query.h"
+
+namespace tgl {
+namespace impl {
+
+template <typename F>
+void query_metrics::update(const query& q, F f)
+{
+    f(m_by_method[q.name()]);
+    if (q.client()) {
+        f(m_by_dc[q.client()->id()]);
+    }
+}
+
+void query_metrics::query_executed(const query& q)
+{
+    update(q, [](tgl_rpc_metrics& m) { m.executed++; });
+}
+
+void query_metrics::query_retried(const query& q)
+{
+    update(q, [](tgl_rpc_metrics& m) { m.retries++; });
+}
+
+void query_metrics::query_timed_out(const query& q)
+{
+    update(q, [](tgl_rpc_metrics& m) { m.timeouts++; });
+}
+
+void query_metrics::query_error(const query& q, int32_t error_code)
+{
+    update(q, [error_code](tgl_rpc_metrics& m) { m.error_codes[error_code]++; });
+}
+
+void query_metrics::query_finished(const query& q, bool success, uint64_t latency_microseconds)
+{
+    update(q, [success, latency_microseconds](tgl_rpc_metrics& m) {
+        if (success) {
+            m.answered++;
+        } else {
+            m.failed++;
+        }
+        m.latency.record(latency_microseconds);
+    });
+}
+
+tgl_query_metrics query_metrics::snapshot(bool reset_after_get)
+{
+    tgl_query_metrics metrics;
+    metrics.by_method.insert(m_by_method.begin(), m_by_method.end());
+    metrics.by_dc = m_by_dc;
+    if (reset_after_get) {
+        m_by_method.clear();
+        m_by_dc.clear();
+    }
+    return metrics;
+}
+
+}
+}
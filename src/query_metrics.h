@@ -0,0 +1,58 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "tgl/tgl_net.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace tgl {
+namespace impl {
+
+class query;
+
+// Counts what happens to queries by query name and by DC. Everything is
+// updated on the network thread, so it needs no locking.
+class query_metrics
+{
+public:
+    void query_executed(const query& q);
+    void query_retried(const query& q);
+    void query_timed_out(const query& q);
+    void query_error(const query& q, int32_t error_code);
+    void query_finished(const query& q, bool success, uint64_t latency_microseconds);
+
+    // Without the gauges, which the user agent fills in.
+    tgl_query_metrics snapshot(bool reset_after_get);
+
+private:
+    template <typename F>
+    void update(const query& q, F f);
+
+    std::unordered_map<std::string, tgl_rpc_metrics> m_by_method;
+    std::map<int32_t, tgl_rpc_metrics> m_by_dc;
+};
+
+}
+}
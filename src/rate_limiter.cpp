@@ -0,0 +1,195 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "rate_limiter.h"
+
+#include "tgl/tgl_timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+// How many seconds of sending a bucket saves up while it isn't used.
+static constexpr double MAX_BURST_SECONDS = 0.25;
+// A weight of 0 would never get a turn.
+static constexpr double MIN_WEIGHT = 0.001;
+
+token_bucket::token_bucket()
+    : m_rate(0)
+    , m_tokens(0)
+    , m_last_refill(0)
+{
+}
+
+void token_bucket::set_rate(uint64_t bytes_per_second, double now)
+{
+    refill(now);
+    m_rate = bytes_per_second;
+    m_tokens = std::min(m_tokens, m_rate * MAX_BURST_SECONDS);
+}
+
+void token_bucket::refill(double now)
+{
+    if (m_rate && now > m_last_refill) {
+        m_tokens = std::min(m_tokens + (now - m_last_refill) * m_rate, m_rate * MAX_BURST_SECONDS);
+    }
+    m_last_refill = now;
+}
+
+double token_bucket::wait_time(double now)
+{
+    if (!m_rate) {
+        return 0;
+    }
+    refill(now);
+    // Less than a byte of debt is rounding.
+    return m_tokens > -1 ? 0 : -m_tokens / m_rate;
+}
+
+void token_bucket::consume(size_t bytes, double now)
+{
+    if (!m_rate) {
+        return;
+    }
+    refill(now);
+    m_tokens -= bytes;
+}
+
+void token_bucket::refund(size_t bytes, double now)
+{
+    if (!m_rate) {
+        return;
+    }
+    refill(now);
+    m_tokens = std::min(m_tokens + bytes, m_rate * MAX_BURST_SECONDS);
+}
+
+transfer_scheduler::transfer_scheduler(const std::function<std::shared_ptr<tgl_timer_factory>()>& timer_factory)
+    : m_timer_factory(timer_factory)
+    , m_virtual_time(0)
+    , m_resume_at(0)
+    , m_resuming(false)
+{
+}
+
+transfer_scheduler::~transfer_scheduler()
+{
+    if (m_timer) {
+        m_timer->cancel();
+    }
+}
+
+double transfer_scheduler::now() const
+{
+    if (auto factory = m_timer_factory()) {
+        return factory->monotonic_time();
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() * 1e-9;
+}
+
+void transfer_scheduler::set_rate_limit(uint64_t bytes_per_second)
+{
+    m_rate_limit.set_rate(bytes_per_second, now());
+    resume_waiting();
+}
+
+void transfer_scheduler::set_share(transfer_share& share, uint64_t max_bytes_per_second, double weight)
+{
+    share.bucket.set_rate(max_bytes_per_second, now());
+    share.weight = std::max(weight, MIN_WEIGHT);
+    resume_waiting();
+}
+
+bool transfer_scheduler::admit(transfer_share& share, size_t bytes, const std::function<void()>& resume)
+{
+    double now = this->now();
+    double wait = std::max(share.bucket.wait_time(now), m_rate_limit.wait_time(now));
+    // Transfers which are waiting already go first, in fair order.
+    if (wait || (m_rate_limit.limited() && !m_resuming && !m_waiting.empty())) {
+        m_waiting[&share] = resume;
+        resume_within(wait);
+        return false;
+    }
+
+    share.bucket.consume(bytes, now);
+    m_rate_limit.consume(bytes, now);
+
+    double start = std::max(share.virtual_time, m_virtual_time);
+    share.virtual_time = start + bytes / share.weight;
+    m_virtual_time = start;
+    return true;
+}
+
+void transfer_scheduler::refund(transfer_share& share, size_t bytes)
+{
+    double now = this->now();
+    share.bucket.refund(bytes, now);
+    m_rate_limit.refund(bytes, now);
+}
+
+void transfer_scheduler::resume_within(double seconds)
+{
+    double at = now() + seconds;
+    if (m_resume_at && m_resume_at <= at) {
+        return;
+    }
+
+    if (!m_timer) {
+        auto factory = m_timer_factory();
+        if (!factory) {
+            return;
+        }
+        m_timer = factory->create_timer([this] {
+            resume_waiting();
+        });
+    }
+    m_resume_at = at;
+    m_timer->start(seconds);
+}
+
+void transfer_scheduler::resume_waiting()
+{
+    if (m_timer) {
+        m_timer->cancel();
+    }
+    m_resume_at = 0;
+
+    std::vector<std::pair<double, std::function<void()>>> waiting;
+    for (const auto& it: m_waiting) {
+        waiting.emplace_back(it.first->virtual_time, it.second);
+    }
+    m_waiting.clear();
+    std::stable_sort(waiting.begin(), waiting.end(),
+            [](const std::pair<double, std::function<void()>>& a, const std::pair<double, std::function<void()>>& b) {
+        return a.first < b.first;
+    });
+
+    m_resuming = true;
+    for (const auto& w: waiting) {
+        w.second();
+    }
+    m_resuming = false;
+}
+
+}
+}
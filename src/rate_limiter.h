@@ -0,0 +1,117 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+
+class tgl_timer;
+class tgl_timer_factory;
+
+namespace tgl {
+namespace impl {
+
+// Limits a byte rate. Sending is allowed while the bucket isn't in debt and
+// then takes the whole part out of it, so parts of any size get through and
+// the long run rate is exactly the limit.
+class token_bucket
+{
+public:
+    token_bucket();
+
+    // 0 means no limit.
+    void set_rate(uint64_t bytes_per_second, double now);
+    uint64_t rate() const { return m_rate; }
+    bool limited() const { return m_rate != 0; }
+
+    // Seconds until the bucket is out of debt, 0 if it is already.
+    double wait_time(double now);
+    void consume(size_t bytes, double now);
+    // Gives back what was consumed for bytes which were not transferred after all.
+    void refund(size_t bytes, double now);
+
+private:
+    void refill(double now);
+
+    uint64_t m_rate;
+    double m_tokens;
+    double m_last_refill;
+};
+
+// What a transfer is allowed: its own limit and its weight when transfers
+// compete for the limit of all of them. The virtual time is the start time
+// fair queueing tag: bytes sent divided by weight, so the transfer with the
+// lowest one is the one which has got less than its share.
+struct transfer_share
+{
+    token_bucket bucket;
+    double weight = 1;
+    double virtual_time = 0;
+};
+
+// Lets parts of transfers through under the limit of all of them and each
+// one's own. A transfer which has to wait is resumed in fair order once the
+// buckets allow it. Time comes from the timer factory, which may be set only
+// after the scheduler has been created.
+class transfer_scheduler
+{
+public:
+    explicit transfer_scheduler(const std::function<std::shared_ptr<tgl_timer_factory>()>& timer_factory);
+    ~transfer_scheduler();
+
+    transfer_scheduler(const transfer_scheduler&) = delete;
+    transfer_scheduler& operator=(const transfer_scheduler&) = delete;
+
+    double now() const;
+
+    // 0 means no limit. Both resume the waiting transfers.
+    void set_rate_limit(uint64_t bytes_per_second);
+    void set_share(transfer_share& share, uint64_t max_bytes_per_second, double weight);
+
+    // Takes bytes out of the share and the overall limit and returns true if
+    // they may be sent now. Otherwise returns false and calls resume once the
+    // transfer should try again; a transfer which keeps asking while it waits
+    // is resumed once, with the last resume it gave.
+    bool admit(transfer_share& share, size_t bytes, const std::function<void()>& resume);
+    // Gives back bytes which were admitted but not transferred.
+    void refund(transfer_share& share, size_t bytes);
+
+    // Calls the waiting transfers, the one which has got the least for its
+    // weight first.
+    void resume_waiting();
+
+private:
+    void resume_within(double seconds);
+
+    std::function<std::shared_ptr<tgl_timer_factory>()> m_timer_factory;
+    token_bucket m_rate_limit;
+    double m_virtual_time; // of the part sent last
+    std::map<transfer_share*, std::function<void()>> m_waiting;
+    std::shared_ptr<tgl_timer> m_timer;
+    double m_resume_at; // 0 if the timer isn't running
+    bool m_resuming;
+};
+
+}
+}
@@ -0,0 +1,164 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+// Lets identical read-only requests share one query. Requests are keyed by
+// their serialized query. A request made while the same one is in flight
+// waits for its answer, and a successful answer is kept for result_ttl
+// seconds to answer the same request right away. The first argument of the
+// callbacks tells whether the request succeeded.
+template <typename... Args>
+class request_coalescer
+{
+public:
+    using callback = std::function<void(Args...)>;
+
+    request_coalescer()
+        : m_result_ttl(0)
+        , m_coalesced(0)
+        , m_cache_hits(0)
+        , m_misses(0)
+    { }
+
+    void set_result_ttl(double seconds) { m_result_ttl = seconds; }
+
+    // Returns true if the caller has to send the query and call finish() with
+    // its answer. Otherwise the callback has been taken care of.
+    bool add(const std::string& key, const callback& cb, double now)
+    {
+        if (m_requests.size() > MAX_REQUESTS) {
+            prune(now);
+        }
+
+        request& r = m_requests[key];
+        if (r.in_flight) {
+            m_coalesced++;
+            r.callbacks.push_back(cb);
+            return false;
+        }
+
+        if (r.expires > now) {
+            m_cache_hits++;
+            if (cb) {
+                call(cb, r.result, std::index_sequence_for<Args...>());
+            }
+            return false;
+        }
+
+        m_misses++;
+        r.in_flight = true;
+        r.callbacks.push_back(cb);
+        return true;
+    }
+
+    void finish(const std::string& key, double now, Args... args)
+    {
+        auto it = m_requests.find(key);
+        if (it == m_requests.end()) {
+            return;
+        }
+
+        std::vector<callback> callbacks = std::move(it->second.callbacks);
+        std::tuple<Args...> result(args...);
+        if (m_result_ttl > 0 && std::get<0>(result)) {
+            it->second.in_flight = false;
+            it->second.callbacks.clear();
+            it->second.expires = now + m_result_ttl;
+            it->second.result = result;
+        } else {
+            m_requests.erase(it);
+        }
+
+        for (const auto& cb: callbacks) {
+            if (cb) {
+                call(cb, result, std::index_sequence_for<Args...>());
+            }
+        }
+    }
+
+    // Drops everything, including callbacks still waiting for an answer.
+    void clear() { m_requests.clear(); }
+
+    void clear_results()
+    {
+        for (auto it = m_requests.begin(); it != m_requests.end(); ) {
+            if (!it->second.in_flight) {
+                it = m_requests.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    uint64_t coalesced() const { return m_coalesced; }
+    uint64_t cache_hits() const { return m_cache_hits; }
+    uint64_t misses() const { return m_misses; }
+    void reset_counters() { m_coalesced = m_cache_hits = m_misses = 0; }
+
+private:
+    static constexpr size_t MAX_REQUESTS = 1024;
+
+    struct request
+    {
+        bool in_flight = false;
+        double expires = 0;
+        std::tuple<Args...> result;
+        std::vector<callback> callbacks;
+    };
+
+    template <size_t... I>
+    static void call(const callback& cb, const std::tuple<Args...>& result, std::index_sequence<I...>)
+    {
+        cb(std::get<I>(result)...);
+    }
+
+    void prune(double now)
+    {
+        for (auto it = m_requests.begin(); it != m_requests.end(); ) {
+            if (!it->second.in_flight && it->second.expires <= now) {
+                it = m_requests.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::unordered_map<std::string, request> m_requests;
+    double m_result_ttl;
+    uint64_t m_coalesced;
+    uint64_t m_cache_hits;
+    uint64_t m_misses;
+};
+
+}
+}
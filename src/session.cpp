@@ -34,12 +34,18 @@ void session::clear()
     seq_no = 0;
     received_messages = 0;
     if (primary_worker) {
+        primary_worker->outbound_queue.clear();
+        primary_worker->outbound_queue_bytes = 0;
+        primary_worker->pending_writes.clear();
         if (primary_worker->connection) {
             primary_worker->connection->close();
         }
         primary_worker = nullptr;
     }
     for (const auto& w: secondary_workers) {
+        w->outbound_queue.clear();
+        w->outbound_queue_bytes = 0;
+        w->pending_writes.clear();
         if (w->connection) {
             w->connection->close();
         }
@@ -48,6 +54,13 @@ void session::clear()
     ack_set.clear();
     ev->cancel();
     ev = nullptr;
+    if (flush_timer) {
+        flush_timer->cancel();
+        flush_timer = nullptr;
+    }
+    flush_scheduled = false;
+    containers.clear();
+    message_containers.clear();
 }
 
 }
@@ -23,6 +23,8 @@
 
 #include "tgl/tgl_timer.h"
 
+#include <deque>
+#include <map>
 #include <memory>
 #include <set>
 #include <stdint.h>
@@ -36,12 +38,33 @@ class tgl_timer;
 namespace tgl {
 namespace impl {
 
+struct outbound_message
+{
+    int64_t msg_id;
+    int32_t seq_no;
+    std::vector<int32_t> body;
+};
+
+// An encrypted message which can't be written yet because it, or one queued
+// before it on the same connection, is still being encrypted on a crypto worker.
+struct pending_write
+{
+    std::unique_ptr<char[]> buffer;
+    int length;
+    bool encrypted;
+    pending_write(): length(0), encrypted(false) { }
+};
+
 struct worker
 {
     std::shared_ptr<tgl_connection> connection;
     std::shared_ptr<tgl_timer> live_timer;
     std::set<int64_t> work_load;
-    explicit worker(const std::shared_ptr<tgl_connection>& c): connection(c) { }
+    // Messages waiting to be packed into one msg_container.
+    std::vector<outbound_message> outbound_queue;
+    size_t outbound_queue_bytes;
+    std::deque<std::shared_ptr<pending_write>> pending_writes;
+    explicit worker(const std::shared_ptr<tgl_connection>& c): connection(c), outbound_queue_bytes(0) { }
 };
 
 struct session
@@ -54,6 +77,12 @@ struct session
     std::unordered_set<std::shared_ptr<worker>> secondary_workers;
     std::set<int64_t> ack_set;
     std::shared_ptr<tgl_timer> ev;
+    std::shared_ptr<tgl_timer> flush_timer;
+    bool flush_scheduled;
+    // The messages sent in each msg_container until they are acked or
+    // answered, so that errors naming the container reach them.
+    std::map<int64_t, std::vector<int64_t>> containers; // by container msg_id
+    std::unordered_map<int64_t, int64_t> message_containers; // container msg_id by message msg_id
     session()
         : session_id(0)
         , last_msg_id(0)
@@ -61,6 +90,8 @@ struct session
         , received_messages(0)
         , ack_set()
         , ev()
+        , flush_timer()
+        , flush_scheduled(false)
     { }
 
     void clear();
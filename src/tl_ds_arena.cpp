@@ -0,0 +1,94 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+
+#include "tl_ds_arena.h"
+
+#include "auto/auto.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace tgl {
+namespace impl {
+
+constexpr size_t ARENA_ALIGNMENT = alignof(std::max_align_t);
+constexpr size_t MAX_CHUNK_SIZE = 1024 * 1024;
+
+tl_ds_arena::tl_ds_arena(size_t initial_chunk_size)
+    : m_current(nullptr)
+    , m_available(0)
+    , m_next_chunk_size(std::max(initial_chunk_size, ARENA_ALIGNMENT))
+    , m_allocated_bytes(0)
+{
+}
+
+void* tl_ds_arena::allocate(size_t size)
+{
+    size = (std::max(size, static_cast<size_t>(1)) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    if (size > m_available) {
+        add_chunk(size);
+    }
+
+    void* result = m_current;
+    m_current += size;
+    m_available -= size;
+    m_allocated_bytes += size;
+
+    memset(result, 0, size);
+    return result;
+}
+
+void tl_ds_arena::reset()
+{
+    if (m_chunks.empty()) {
+        return;
+    }
+
+    // Keep the current chunk; chunks grow, so it is usually the largest one.
+    size_t chunk_size = m_available + (m_current - m_chunks.back().get());
+    std::unique_ptr<char[]> chunk = std::move(m_chunks.back());
+    m_chunks.clear();
+    m_chunks.push_back(std::move(chunk));
+    m_current = m_chunks.back().get();
+    m_available = chunk_size;
+    m_allocated_bytes = 0;
+}
+
+void tl_ds_arena::add_chunk(size_t min_size)
+{
+    size_t chunk_size = std::max(m_next_chunk_size, min_size);
+    // new char[] is aligned for any fundamental type.
+    m_chunks.emplace_back(new char[chunk_size]);
+    m_current = m_chunks.back().get();
+    m_available = chunk_size;
+    m_next_chunk_size = std::min(m_next_chunk_size * 2, MAX_CHUNK_SIZE);
+}
+
+void* tl_ds_alloc(tl_ds_arena* arena, size_t size)
+{
+    if (arena) {
+        return arena->allocate(size);
+    }
+    return calloc(1, size);
+}
+
+}
+}
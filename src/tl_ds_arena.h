@@ -0,0 +1,65 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+// A bump allocator for the tl_ds_* tree of one response. Pass it to
+// fetch_ds_type_*() and everything the fetch allocates comes from a few
+// large chunks which are released at once when the arena goes away.
+// Trees fetched into an arena must not be passed to free_ds_type_*().
+class tl_ds_arena
+{
+public:
+    explicit tl_ds_arena(size_t initial_chunk_size = 16 * 1024);
+
+    tl_ds_arena(const tl_ds_arena&) = delete;
+    tl_ds_arena& operator=(const tl_ds_arena&) = delete;
+
+    // Returns zero-filled memory aligned for any scalar type.
+    void* allocate(size_t size);
+
+    // Forgets everything allocated so far but keeps the current chunk
+    // around, so decoding a sequence of objects one by one reuses it.
+    void reset();
+
+    size_t allocated_bytes() const { return m_allocated_bytes; }
+    size_t chunk_count() const { return m_chunks.size(); }
+
+private:
+    void add_chunk(size_t min_size);
+
+private:
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    char* m_current;
+    size_t m_available;
+    size_t m_next_chunk_size;
+    size_t m_allocated_bytes;
+};
+
+}
+}
@@ -0,0 +1,88 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "tl_view.h"
+
+#include "auto/constants.h"
+
+#include <algorithm>
+
+namespace tgl {
+namespace impl {
+
+tl_object_view::tl_object_view()
+    : m_end(nullptr)
+    , m_magic(0)
+{
+    std::fill(std::begin(m_fields), std::end(m_fields), nullptr);
+}
+
+bool tl_object_view::index(tgl_in_buffer* in, const paramed_type* type)
+{
+    std::fill(std::begin(m_fields), std::end(m_fields), nullptr);
+    m_magic = 0;
+    m_end = in->end;
+    return view_type_any(in, type, m_fields, &m_magic) >= 0;
+}
+
+bool tl_object_view::has_field(int field) const
+{
+    return field >= 0 && field < TL_VIEW_MAX_FIELDS && m_fields[field];
+}
+
+tgl_in_buffer tl_object_view::field(int field) const
+{
+    if (!has_field(field)) {
+        return { m_end, m_end };
+    }
+    return { m_fields[field], m_end };
+}
+
+int32_t tl_object_view::field_i32(int field) const
+{
+    tgl_in_buffer in = this->field(field);
+    return in_remaining(&in) >= 4 ? fetch_i32(&in) : 0;
+}
+
+bool tl_vector_view::index(tgl_in_buffer in, const paramed_type* element_type, bool bare)
+{
+    m_size = 0;
+    m_element_type = element_type;
+
+    if (!bare) {
+        if (in_remaining(&in) < 4 || fetch_i32(&in) != static_cast<int32_t>(CODE_vector)) {
+            return false;
+        }
+    }
+    if (in_remaining(&in) < 4) {
+        return false;
+    }
+    int32_t count = fetch_i32(&in);
+    if (count < 0 || count > in_remaining(&in) / 4) {
+        return false;
+    }
+
+    m_begin = in;
+    m_size = count;
+    return true;
+}
+
+}
+}
@@ -0,0 +1,106 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "auto/auto.h"
+#include "auto/auto_fetch_ds.h"
+#include "auto/auto_view.h"
+#include "mtproto_common.h"
+#include "tl_ds_arena.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tgl {
+namespace impl {
+
+// A zero-copy view of one TL object in a tgl_in_buffer. index() validates
+// the object in a single scan without allocating anything and remembers
+// where each field of the constructor starts. Fields are then decoded on
+// demand, and the ones the caller never asks for are never materialized.
+// The view points into the buffer, which must outlive it.
+class tl_object_view
+{
+public:
+    tl_object_view();
+
+    // Scans the object at in->ptr and advances in->ptr past it.
+    bool index(tgl_in_buffer* in, const paramed_type* type);
+
+    uint32_t magic() const { return m_magic; }
+
+    // Takes an index from view_field_<type>_<name>(magic()). Returns false
+    // if the constructor doesn't have the field or an optional field is absent.
+    bool has_field(int field) const;
+
+    // The input starting at the field, to be passed to fetch_*() or to
+    // tl_vector_view::index().
+    tgl_in_buffer field(int field) const;
+
+    int32_t field_i32(int field) const;
+
+private:
+    const int32_t* m_fields[TL_VIEW_MAX_FIELDS];
+    const int32_t* m_end;
+    uint32_t m_magic;
+};
+
+// A Vector field of an object which tl_object_view::index() has validated.
+// Only the header is read up front. The elements are decoded in order
+// straight from the buffer, so the answer is not scanned again.
+class tl_vector_view
+{
+public:
+    tl_vector_view() : m_begin(), m_size(0), m_element_type(nullptr) { }
+
+    // The element type must outlive the view.
+    bool index(tgl_in_buffer in, const paramed_type* element_type, bool bare = false);
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Decodes the elements one at a time and calls f with each of them.
+    // The elements share an arena which is reset in between, so at most one
+    // decoded element is alive at a time and f must not keep it.
+    template<typename DS, typename Function>
+    void for_each(Function f) const
+    {
+        tl_ds_arena arena;
+        tgl_in_buffer in = m_begin;
+        for (size_t i = 0; i < m_size; ++i) {
+            const DS* DS_E = static_cast<const DS*>(fetch_ds_type_any(&in, m_element_type, &arena));
+            if (!DS_E) {
+                // The rest can't be found without knowing where this one ends.
+                break;
+            }
+            f(DS_E);
+            arena.reset();
+        }
+    }
+
+private:
+    tgl_in_buffer m_begin; // the first element
+    size_t m_size;
+    const paramed_type* m_element_type;
+};
+
+}
+}
@@ -38,8 +38,6 @@
 namespace tgl {
 namespace impl {
 
-int tgl_inflate(const void* input, int ilen, void* output, int olen);
-
 static inline void check_crypto_result(int r)
 {
     if (!r) {
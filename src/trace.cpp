@@ -0,0 +1,236 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+namespace tgl {
+namespace impl {
+
+std::atomic<bool> g_tracing_enabled(false);
+
+namespace {
+
+// One thread writes a ring, tgl_dump_trace() may read it at the same time.
+// Every slot carries a sequence number which is odd while the slot is being
+// written and 2 * (index + 1) once event number index is in it, so a reader
+// can tell a torn or overwritten slot from the event it expected.
+struct trace_slot
+{
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> time;
+    std::atomic<int64_t> msg_id;
+    std::atomic<uint64_t> packed; // size, dc_id and type
+};
+
+struct trace_ring
+{
+    trace_ring(size_t capacity, uint32_t thread)
+        : slots(new trace_slot[capacity]())
+        , capacity(capacity)
+        , thread(thread)
+        , head(0)
+    { }
+
+    std::unique_ptr<trace_slot[]> slots;
+    const size_t capacity;
+    const uint32_t thread;
+    std::atomic<uint64_t> head; // number of events ever written
+};
+
+struct trace_registry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<trace_ring>> rings;
+    size_t events_per_thread = 0;
+    uint32_t next_thread = 0;
+};
+
+struct thread_trace_ring
+{
+    std::shared_ptr<trace_ring> ring;
+    uint64_t generation = 0;
+};
+
+}
+
+// Bumped by tgl_start_tracing() so that threads drop their old rings.
+static std::atomic<uint64_t> g_trace_generation(0);
+static thread_local thread_trace_ring t_trace_ring;
+
+static trace_registry& registry()
+{
+    static trace_registry r;
+    return r;
+}
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* event_name(tgl_trace_event_type type)
+{
+    switch (type) {
+    case tgl_trace_event_type::message_queued: return "message_queued";
+    case tgl_trace_event_type::frame_received: return "frame_received";
+    case tgl_trace_event_type::message_received: return "message_received";
+    case tgl_trace_event_type::query_result: return "query_result";
+    case tgl_trace_event_type::query_resent: return "query_resent";
+    case tgl_trace_event_type::query_regenerated: return "query_regenerated";
+    case tgl_trace_event_type::bad_server_salt: return "bad_server_salt";
+    }
+    return "unknown";
+}
+
+void record_trace_event(tgl_trace_event_type type, int32_t dc_id, int64_t msg_id, size_t size)
+{
+    uint64_t generation = g_trace_generation.load(std::memory_order_acquire);
+    if (!t_trace_ring.ring || t_trace_ring.generation != generation) {
+        trace_registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (!g_tracing_enabled.load(std::memory_order_relaxed) || !r.events_per_thread) {
+            return;
+        }
+        t_trace_ring.ring = std::make_shared<trace_ring>(r.events_per_thread, r.next_thread++);
+        t_trace_ring.generation = g_trace_generation.load(std::memory_order_relaxed);
+        r.rings.push_back(t_trace_ring.ring);
+    }
+
+    trace_ring& ring = *t_trace_ring.ring;
+    uint64_t index = ring.head.load(std::memory_order_relaxed);
+    trace_slot& slot = ring.slots[index % ring.capacity];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(now_ns(), std::memory_order_relaxed);
+    slot.msg_id.store(msg_id, std::memory_order_relaxed);
+    slot.packed.store(static_cast<uint64_t>(std::min<size_t>(size, UINT32_MAX))
+            | static_cast<uint64_t>(static_cast<uint16_t>(dc_id)) << 32
+            | static_cast<uint64_t>(type) << 48, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+    ring.head.store(index + 1, std::memory_order_release);
+}
+
+}
+}
+
+using namespace tgl::impl;
+
+void tgl_start_tracing(size_t events_per_thread)
+{
+    trace_registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.rings.clear();
+    r.events_per_thread = events_per_thread;
+    r.next_thread = 0;
+    g_trace_generation.fetch_add(1, std::memory_order_release);
+    g_tracing_enabled.store(events_per_thread > 0, std::memory_order_relaxed);
+}
+
+void tgl_stop_tracing()
+{
+    g_tracing_enabled.store(false, std::memory_order_relaxed);
+}
+
+std::vector<tgl_trace_event> tgl_dump_trace()
+{
+    std::vector<tgl_trace_event> events;
+    trace_registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const auto& ring: r.rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > ring->capacity ? head - ring->capacity : 0;
+        for (uint64_t index = first; index < head; ++index) {
+            const trace_slot& slot = ring->slots[index % ring->capacity];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            tgl_trace_event event;
+            event.time = slot.time.load(std::memory_order_relaxed);
+            event.msg_id = slot.msg_id.load(std::memory_order_relaxed);
+            uint64_t packed = slot.packed.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence != 2 * index + 2 || slot.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue; // overwritten while we were reading it
+            }
+            event.size = static_cast<uint32_t>(packed);
+            event.dc_id = static_cast<int16_t>(packed >> 32);
+            event.type = static_cast<tgl_trace_event_type>(packed >> 48);
+            event.thread = ring->thread;
+            events.push_back(event);
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const tgl_trace_event& a, const tgl_trace_event& b) {
+        return a.time < b.time;
+    });
+    return events;
+}
+
+std::string tgl_trace_to_chrome_json(const std::vector<tgl_trace_event>& events)
+{
+    std::unordered_set<int64_t> queued;
+    std::unordered_set<int64_t> answered;
+    for (const auto& event: events) {
+        if (event.type == tgl_trace_event_type::message_queued) {
+            queued.insert(event.msg_id);
+        } else if (event.type == tgl_trace_event_type::query_result && queued.count(event.msg_id)) {
+            answered.insert(event.msg_id);
+        }
+    }
+
+    uint64_t start = events.empty() ? 0 : events.front().time;
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    char buffer[256];
+    bool first = true;
+    auto append = [&](int length) {
+        if (length > 0) {
+            json += first ? "" : ",";
+            json.append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+            first = false;
+        }
+    };
+
+    for (const auto& event: events) {
+        double ts = (event.time - start) / 1000.0;
+        append(snprintf(buffer, sizeof(buffer),
+                "{\"name\":\"%s\",\"cat\":\"mtproto\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u,"
+                "\"args\":{\"msg_id\":%lld,\"size\":%u}}",
+                event_name(event.type), ts, event.dc_id, event.thread,
+                static_cast<long long>(event.msg_id), event.size));
+
+        // A query from being queued to its answer.
+        bool begins = event.type == tgl_trace_event_type::message_queued && answered.count(event.msg_id);
+        bool ends = event.type == tgl_trace_event_type::query_result && answered.count(event.msg_id);
+        if (begins || ends) {
+            append(snprintf(buffer, sizeof(buffer),
+                    "{\"name\":\"query\",\"cat\":\"query\",\"ph\":\"%s\",\"id\":\"%llx\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                    begins ? "b" : "e", static_cast<unsigned long long>(event.msg_id), ts, event.dc_id, event.thread));
+        }
+    }
+
+    json += "]}";
+    return json;
+}
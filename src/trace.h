@@ -0,0 +1,44 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "tgl/tgl_trace.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace tgl {
+namespace impl {
+
+extern std::atomic<bool> g_tracing_enabled;
+
+void record_trace_event(tgl_trace_event_type type, int32_t dc_id, int64_t msg_id, size_t size);
+
+inline void trace_event(tgl_trace_event_type type, int32_t dc_id, int64_t msg_id, size_t size)
+{
+    if (g_tracing_enabled.load(std::memory_order_relaxed)) {
+        record_trace_event(type, dc_id, msg_id, size);
+    }
+}
+
+}
+}
@@ -27,7 +27,12 @@
 #include "auto/auto_types.h"
 #include "crypto/crypto_aes.h"
 #include "crypto/crypto_md5.h"
+#include "crypto/crypto_mem.h"
+#include "crypto/crypto_sha.h"
+#include "crypto_executor.h"
+#include "download_cache.h"
 #include "download_task.h"
+#include "file_io.h"
 #include "message.h"
 #include "mtproto_client.h"
 #include "mtproto_common.h"
@@ -39,16 +44,126 @@
 #include "tools.h"
 #include "tgl/tgl_mime_type.h"
 #include "tgl/tgl_secure_random.h"
+#include "tgl/tgl_timer.h"
 #include "tgl/tgl_update_callback.h"
+#include "tgl/tgl_upload_state_storage.h"
 #include "upload_task.h"
 
 #include <boost/filesystem.hpp>
+#include <algorithm>
 #include <limits>
+#include <sstream>
+#include <set>
 
 namespace tgl {
 namespace impl {
 
+// Parts can be any power of two from MIN_PART_SIZE to MAX_PART_SIZE.
+static constexpr size_t MIN_PART_SIZE = 1024;
 static constexpr size_t MAX_PART_SIZE = 512 * 1024;
+static constexpr size_t MAX_PARTS = 3000; // How do we get this number?
+// Encrypted parts which arrive ahead of the decryption offset are kept in
+// memory up to this many bytes per download and put aside in the file after
+// that. It also caps how much is read back and decrypted in one go.
+static constexpr size_t MAX_REASSEMBLY_BYTES = 2 * 1024 * 1024;
+// How far uploads of mapped files ask the kernel to read ahead of the part
+// being sent.
+static constexpr size_t UPLOAD_READAHEAD_PARTS = 4;
+// How often a download part which doesn't match its hash is requested again.
+static constexpr int MAX_PART_RETRIES = 3;
+static constexpr size_t DEFAULT_MAX_DOWNLOAD_PARTS_PER_FILE = 8;
+static constexpr size_t DEFAULT_MAX_DOWNLOAD_PARTS_PER_DC = 16;
+// How long changes to the download cache index are collected before it is
+// written back.
+static constexpr double DOWNLOAD_CACHE_SAVE_DELAY = 5;
+
+// One part of an encrypted upload on its way through a crypto worker.
+struct upload_part_encryption
+{
+    size_t part_num = 0;
+    size_t size = 0; // with the padding
+    std::shared_ptr<query_upload_file_part> query;
+    std::shared_ptr<std::vector<uint8_t>> buffer;
+    // A part of a mapped file is copied out of the mapping by the job too, as
+    // it's encrypted in place, so the read overlaps with other parts.
+    std::shared_ptr<const mapped_file> source;
+    size_t source_offset = 0;
+    size_t source_length = 0;
+    std::array<unsigned char, 15> padding;
+    size_t padding_size = 0;
+    std::shared_ptr<const TGLC_aes_key> aes_key;
+    std::array<unsigned char, 32> iv;
+    double read_time = 0;
+    double crypto_time = 0;
+
+    ~upload_part_encryption()
+    {
+        TGLC_cleanse(iv.data(), iv.size());
+    }
+
+    void run()
+    {
+        double start = tgl_get_monotonic_time();
+        if (source) {
+            const unsigned char* data = source->data() + source_offset;
+            buffer->assign(data, data + source_length);
+            double read = tgl_get_monotonic_time();
+            read_time = read - start;
+            start = read;
+        }
+        buffer->insert(buffer->end(), padding.begin(), padding.begin() + padding_size);
+        TGLC_aes_ige_encrypt(buffer->data(), buffer->data(), buffer->size(), aes_key.get(), iv.data(), 1);
+        crypto_time = tgl_get_monotonic_time() - start;
+    }
+};
+
+// Small files downloaded together, see tgl_transfer_manager::download_batch.
+struct batch_download
+{
+    struct item
+    {
+        std::string data; // received so far
+    };
+
+    std::vector<item> items;
+    std::vector<tgl_batch_download_result> results;
+    std::map<int32_t, std::deque<size_t>> queued_items; // not requested yet, by DC
+    size_t remaining = 0;
+    tgl_batch_download_callback callback;
+    transfer_share share;
+};
+
+// The downloaded parts of an encrypted file which are next in line to be
+// decrypted, taken out of download_task::running_parts while that happens.
+struct download_parts_decryption
+{
+    std::vector<std::pair<size_t, download_data>> parts;
+    std::shared_ptr<const TGLC_aes_key> aes_key;
+    std::vector<unsigned char> iv;
+    bool misaligned = false;
+    double crypto_time = 0;
+
+    ~download_parts_decryption()
+    {
+        TGLC_cleanse(iv.data(), iv.size());
+    }
+
+    void run()
+    {
+        double start = tgl_get_monotonic_time();
+        for (auto& part: parts) {
+            char* data = part.second.data();
+            size_t length = part.second.length();
+            if (length & 15) {
+                misaligned = true;
+                break;
+            }
+            TGLC_aes_ige_encrypt(reinterpret_cast<const unsigned char*>(data),
+                    reinterpret_cast<unsigned char*>(data), length, aes_key.get(), iv.data(), 0);
+        }
+        crypto_time = tgl_get_monotonic_time() - start;
+    }
+};
 
 class query_set_photo: public query
 {
@@ -83,12 +198,160 @@ private:
     std::function<void(bool)> m_callback;
 };
 
+transfer_manager::transfer_manager(const std::weak_ptr<user_agent>& weak_ua, const std::string& download_directory)
+    : m_user_agent(weak_ua)
+    , m_download_directory(download_directory)
+    , m_download_cache(new download_cache(download_directory))
+    , m_download_cache_save_pending(false)
+    , m_max_download_parts_per_file(DEFAULT_MAX_DOWNLOAD_PARTS_PER_FILE)
+    , m_max_download_parts_per_dc(DEFAULT_MAX_DOWNLOAD_PARTS_PER_DC)
+    , m_scheduler([weak_ua] {
+        auto ua = weak_ua.lock();
+        return ua ? ua->timer_factory() : nullptr;
+    })
+{
+}
+
+static size_t part_size_for(double bytes)
+{
+    size_t part_size = MIN_PART_SIZE;
+    while (part_size < bytes && part_size < MAX_PART_SIZE) {
+        part_size <<= 1;
+    }
+    return part_size;
+}
+
+static bool is_valid_part_size(size_t part_size)
+{
+    return part_size >= MIN_PART_SIZE && part_size <= MAX_PART_SIZE && !(part_size & (part_size - 1));
+}
+
+tgl_part_size_choice transfer_manager::choose_part_size(int64_t transfer_id, int64_t file_size, int32_t dc, size_t parallelism) const
+{
+    tgl_part_size_choice choice;
+    std::ostringstream reason;
+
+    if (file_size <= 0) {
+        choice.part_size = MAX_PART_SIZE;
+        reason << "the file size is unknown";
+    } else {
+        // The smallest part that keeps the file within MAX_PARTS, the one that
+        // keeps all parallel connections busy, and the one that takes about a
+        // round trip to transfer on this DC. The largest of them wins.
+        size_t by_count = part_size_for(static_cast<double>(file_size) / MAX_PARTS);
+        size_t by_parallelism = part_size_for(static_cast<double>(file_size) / std::max(parallelism, static_cast<size_t>(1)));
+        size_t by_bandwidth = MIN_PART_SIZE;
+        auto it = m_dc_transfer_stats.find(dc);
+        if (it != m_dc_transfer_stats.end()) {
+            by_bandwidth = part_size_for(it->second.throughput * it->second.min_part_latency);
+        }
+
+        choice.part_size = std::max(by_count, std::max(by_parallelism, by_bandwidth));
+        if (choice.part_size == by_count && by_count > MIN_PART_SIZE) {
+            reason << "the file has to fit into " << MAX_PARTS << " parts";
+        } else if (choice.part_size == by_bandwidth && by_bandwidth > MIN_PART_SIZE) {
+            reason << "DC " << dc << " transfers about " << static_cast<int64_t>(it->second.throughput) << " bytes/s with "
+                    << static_cast<int>(it->second.min_part_latency * 1000) << " ms round trips";
+        } else if (choice.part_size > MIN_PART_SIZE) {
+            reason << "the file is split over " << parallelism << " parallel parts";
+        } else {
+            reason << "the file is small";
+        }
+        choice.part_count = (file_size + choice.part_size - 1) / choice.part_size;
+    }
+
+    choice.reason = reason.str();
+    report_part_size(transfer_id, choice);
+    return choice;
+}
+
+void transfer_manager::report_part_size(int64_t transfer_id, const tgl_part_size_choice& choice) const
+{
+    TGL_DEBUG("transfer " << transfer_id << " uses " << choice.part_size << " byte parts because " << choice.reason);
+    if (m_part_size_callback) {
+        m_part_size_callback(transfer_id, choice);
+    }
+}
+
+void transfer_manager::record_part_transfer(int32_t dc, size_t bytes, double latency)
+{
+    if (latency <= 0) {
+        return;
+    }
+    auto& stats = m_dc_transfer_stats[dc];
+    if (!stats.min_part_latency || latency < stats.min_part_latency) {
+        stats.min_part_latency = latency;
+    }
+    double throughput = bytes / latency;
+    stats.throughput = stats.throughput ? stats.throughput * 0.8 + throughput * 0.2 : throughput;
+}
+
+transfer_manager::~transfer_manager()
+{
+}
+
 bool transfer_manager::file_exists(const tgl_file_location &location) const
 {
+    if (!cached_file_on_disk(location).empty()) {
+        return true;
+    }
     std::string path = get_file_path(location.access_hash());
     return boost::filesystem::exists(path);
 }
 
+std::string transfer_manager::cached_file_path(const tgl_file_location& location)
+{
+    return cached_file_on_disk(location);
+}
+
+std::string transfer_manager::cached_file_on_disk(const tgl_file_location& location, int64_t* size) const
+{
+    std::string path = m_download_cache->lookup(location, size);
+    if (path.empty()) {
+        return path;
+    }
+
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(path, ec)) {
+        TGL_DEBUG("cached file " << path << " has gone, dropping it from the cache");
+        m_download_cache->remove(location);
+        save_download_cache_later();
+        return std::string();
+    }
+    return path;
+}
+
+void transfer_manager::set_download_cache_budget(uint64_t bytes)
+{
+    m_download_cache->set_budget(bytes);
+    save_download_cache_later();
+}
+
+void transfer_manager::save_download_cache_later() const
+{
+    if (m_download_cache_save_pending) {
+        return;
+    }
+
+    auto ua = m_user_agent.lock();
+    if (!ua) {
+        m_download_cache->save_index();
+        return;
+    }
+
+    if (!m_download_cache_timer) {
+        std::weak_ptr<const transfer_manager> weak_this(shared_from_this());
+        m_download_cache_timer = ua->timer_factory()->create_timer([weak_this] {
+            if (auto shared_this = weak_this.lock()) {
+                shared_this->m_download_cache_save_pending = false;
+                shared_this->m_download_cache->save_index();
+            }
+        });
+    }
+    m_download_cache_save_pending = true;
+    m_download_cache_timer->start(DOWNLOAD_CACHE_SAVE_DELAY);
+}
+
 std::string transfer_manager::get_file_path(int64_t secret) const
 {
     std::ostringstream stream;
@@ -312,9 +575,23 @@ void transfer_manager::upload_end(const std::shared_ptr<upload_task>& u)
     }
 
     TGL_DEBUG("uploaded all parts");
+    TGL_DEBUG("upload of message " << u->message_id << " spent " << u->read_time << " seconds reading, "
+            << u->crypto_time << " seconds encrypting and " << u->send_time << " seconds sending " << u->size << " bytes");
+    if (m_upload_stage_times_callback) {
+        tgl_upload_stage_times times;
+        times.read_seconds = u->read_time;
+        times.encrypt_seconds = u->crypto_time;
+        times.send_seconds = u->send_time;
+        m_upload_stage_times_callback(u->message_id, times);
+    }
 
     m_uploads.erase(it);
 
+    // A failed upload keeps its state so it can be resumed later.
+    if (u->is_resumable() && u->status != tgl_upload_status::failed) {
+        remove_upload_state(u);
+    }
+
     if (u->status != tgl_upload_status::uploading) {
         return;
     }
@@ -336,7 +613,7 @@ void transfer_manager::upload_end(const std::shared_ptr<upload_task>& u)
 
 void transfer_manager::upload_multiple_parts(const std::shared_ptr<upload_task>&u, size_t count)
 {
-    for (size_t i = 0; u->part_num * MAX_PART_SIZE < u->size && i < count; ++i) {
+    for (size_t i = 0; u->part_num * u->part_size < u->size && i < count && m_uploads.count(u->message_id); ++i) {
         upload_part(u);
     }
 }
@@ -345,7 +622,23 @@ void transfer_manager::upload_part_finished(const std::shared_ptr<upload_task>&
 {
     u->running_parts.erase(part_number);
 
-    u->uploaded_bytes += MAX_PART_SIZE;
+    auto sent = u->part_send_times.find(part_number);
+    if (sent != u->part_send_times.end()) {
+        double latency = tgl_get_monotonic_time() - sent->second;
+        u->send_time += latency;
+        u->part_send_times.erase(sent);
+        auto ua = m_user_agent.lock();
+        if (ua && success && part_number != std::numeric_limits<size_t>::max()) {
+            record_part_transfer(ua->active_client()->id(), u->part_size, latency);
+        }
+    }
+
+    if (success && part_number < u->acknowledged_parts.size()) {
+        u->acknowledged_parts[part_number] = true;
+        save_upload_state(u);
+    }
+
+    u->uploaded_bytes += u->part_size;
     if (u->uploaded_bytes > u->size) {
         u->uploaded_bytes = u->size;
     }
@@ -366,7 +659,7 @@ void transfer_manager::upload_part_finished(const std::shared_ptr<upload_task>&
         u->set_status(tgl_upload_status::uploading);
     }
 
-    if (u->part_num * MAX_PART_SIZE < u->size) {
+    if (u->part_num * u->part_size < u->size) {
         upload_part(u);
     } else if (u->running_parts.empty()) {
         upload_end(u);
@@ -383,23 +676,55 @@ void transfer_manager::upload_part(const std::shared_ptr<upload_task>& u)
         return;
     }
 
-    auto offset = u->part_num * MAX_PART_SIZE;
-    u->running_parts.insert(u->part_num);
+    // Skip what the server already has from before the upload was resumed.
+    while (u->part_num < u->acknowledged_parts.size() && u->acknowledged_parts[u->part_num]) {
+        u->part_num++;
+    }
+
+    auto offset = u->part_num * u->part_size;
+    if (offset >= u->size) {
+        if (u->running_parts.empty()) {
+            upload_end(u);
+        }
+        return;
+    }
+
+    if (!admit_upload_part(u)) {
+        return;
+    }
+
+    size_t part_num = u->part_num++;
+    u->running_parts.insert(part_num);
     auto q = std::make_shared<query_upload_file_part>(*ua, u, std::bind(&transfer_manager::upload_part_finished,
-            shared_from_this(), u, u->part_num, std::placeholders::_1));
+            shared_from_this(), u, part_num, std::placeholders::_1));
     if (u->size < BIG_FILE_THRESHOLD) {
         q->out_i32(CODE_upload_save_file_part);
         q->out_i64(u->id);
-        q->out_i32(u->part_num++);
+        q->out_i32(part_num);
     } else {
         q->out_i32(CODE_upload_save_big_file_part);
         q->out_i64(u->id);
-        q->out_i32(u->part_num++);
-        q->out_i32((u->size + MAX_PART_SIZE - 1) / MAX_PART_SIZE);
+        q->out_i32(part_num);
+        q->out_i32((u->size + u->part_size - 1) / u->part_size);
     }
 
-    auto sending_buffer = u->read_callback(MAX_PART_SIZE);
-    size_t read_size = sending_buffer->size();
+    // Parts go through reading, encryption for secret chats, and sending.
+    // Reading from a mapping is left to the kernel's read ahead and to the
+    // crypto worker, the read callbacks run here.
+    std::shared_ptr<std::vector<uint8_t>> sending_buffer;
+    const uint8_t* part_data = nullptr;
+    size_t read_size = 0;
+    double read_start = tgl_get_monotonic_time();
+    if (u->source) {
+        part_data = u->source->data() + offset;
+        read_size = std::min(u->part_size, static_cast<size_t>(u->size - offset));
+        u->source->prefetch(offset + read_size, u->part_size * UPLOAD_READAHEAD_PARTS);
+    } else {
+        sending_buffer = u->read_at_callback ? u->read_at_callback(offset, u->part_size) : u->read_callback(u->part_size);
+        part_data = sending_buffer->data();
+        read_size = sending_buffer->size();
+        u->read_time += tgl_get_monotonic_time() - read_start;
+    }
 
     if (read_size == 0) {
         TGL_WARNING("could not send empty file");
@@ -412,26 +737,102 @@ void transfer_manager::upload_part(const std::shared_ptr<upload_task>& u)
     offset += read_size;
 
     if (u->is_encrypted()) {
+        auto job = std::make_shared<upload_part_encryption>();
+        job->part_num = part_num;
+        job->query = q;
+        if (u->source) {
+            job->buffer = std::make_shared<std::vector<uint8_t>>();
+            job->source = u->source;
+            job->source_offset = offset - read_size;
+            job->source_length = read_size;
+        } else {
+            job->buffer = sending_buffer;
+        }
+
         if (read_size & 15) {
             assert(offset == u->size);
-            int32_t padding_size = (-read_size) & 15;
-            sending_buffer->resize(read_size + padding_size);
-            tgl_secure_random(reinterpret_cast<unsigned char*>(sending_buffer->data()) + read_size, padding_size);
-            read_size += padding_size;
+            job->padding_size = (-read_size) & 15;
+            tgl_secure_random(job->padding.data(), job->padding_size);
+            read_size += job->padding_size;
+        }
+
+        if (offset != u->size) {
+            assert(u->part_size == read_size);
         }
 
-        TGLC_aes_key aes_key;
-        TGLC_aes_set_encrypt_key(u->key.data(), 256, &aes_key);
-        TGLC_aes_ige_encrypt(reinterpret_cast<unsigned char*>(sending_buffer->data()),
-                reinterpret_cast<unsigned char*>(sending_buffer->data()), read_size, &aes_key, u->iv.data(), 1);
-        memset(&aes_key, 0, sizeof(aes_key));
+        job->size = read_size;
+        u->parts_to_encrypt.push_back(job);
+        encrypt_upload_parts(u);
+        return;
+    }
+    q->out_string(reinterpret_cast<const char*>(part_data), read_size);
+    if (u->source) {
+        // Copying out of the mapping is where its pages are read.
+        u->read_time += tgl_get_monotonic_time() - read_start;
     }
-    q->out_string(reinterpret_cast<const char*>(sending_buffer->data()), read_size);
 
     if (offset != u->size) {
-        assert(MAX_PART_SIZE == read_size);
+        assert(u->part_size == read_size);
+    }
+    send_upload_part(*ua, u, part_num, q);
+}
+
+void transfer_manager::send_upload_part(user_agent& ua, const std::shared_ptr<upload_task>& u, size_t part_num,
+        const std::shared_ptr<query_upload_file_part>& q)
+{
+    u->part_send_times[part_num] = tgl_get_monotonic_time();
+    q->execute(ua.active_client());
+}
+
+void transfer_manager::encrypt_upload_parts(const std::shared_ptr<upload_task>& u)
+{
+    auto ua = m_user_agent.lock();
+    if (!ua) {
+        TGL_ERROR("the user agent has gone");
+        u->parts_to_encrypt.clear();
+        return;
+    }
+
+    while (!u->encrypting && !u->parts_to_encrypt.empty()) {
+        auto job = std::move(u->parts_to_encrypt.front());
+        u->parts_to_encrypt.pop_front();
+        job->aes_key = u->aes_key;
+        job->iv = u->iv;
+        if (u->is_resumable()) {
+            u->part_ivs[job->part_num] = u->iv;
+        }
+        u->encrypted_parts = job->part_num + 1;
+
+        auto executor = ua->crypto_executor(job->size);
+        if (!executor) {
+            job->run();
+            u->iv = job->iv;
+            u->read_time += job->read_time;
+            u->crypto_time += job->crypto_time;
+            job->query->out_string(reinterpret_cast<const char*>(job->buffer->data()), job->buffer->size());
+            send_upload_part(*ua, u, job->part_num, job->query);
+            continue;
+        }
+
+        u->encrypting = true;
+        std::weak_ptr<transfer_manager> weak_this(shared_from_this());
+        executor->execute([job] { job->run(); }, [weak_this, u, job] {
+            u->encrypting = false;
+            u->iv = job->iv;
+            u->read_time += job->read_time;
+            u->crypto_time += job->crypto_time;
+            auto shared_this = weak_this.lock();
+            auto ua = shared_this ? shared_this->m_user_agent.lock() : nullptr;
+            if (!ua || !shared_this->m_uploads.count(u->message_id)) {
+                // The upload has ended in the meantime.
+                u->parts_to_encrypt.clear();
+                return;
+            }
+            job->query->out_string(reinterpret_cast<const char*>(job->buffer->data()), job->buffer->size());
+            shared_this->send_upload_part(*ua, u, job->part_num, job->query);
+            shared_this->encrypt_upload_parts(u);
+        });
     }
-    q->execute(ua->active_client());
 }
 
 void transfer_manager::upload_thumb(const std::shared_ptr<upload_task>& u)
@@ -463,7 +864,7 @@ void transfer_manager::upload_thumb(const std::shared_ptr<upload_task>& u)
     q->out_i32(0);
     q->out_string(reinterpret_cast<char*>(u->thumb.data()), u->thumb.size());
 
-    q->execute(ua->active_client());
+    send_upload_part(*ua, u, std::numeric_limits<size_t>::max(), q);
 }
 
 
@@ -472,7 +873,9 @@ void transfer_manager::upload_document(const tgl_input_peer_t& to_id,
         const std::shared_ptr<tgl_upload_document>& document,
         const tgl_upload_callback& callback,
         const tgl_read_callback& read_callback,
-        const tgl_upload_part_done_callback& done_callback)
+        const tgl_upload_part_done_callback& done_callback,
+        const tgl_read_at_callback& read_at_callback,
+        bool resumable)
 {
     TGL_DEBUG("upload_document " << document->file_name << " with size " << document->file_size
             << " and dimension " << document->width << "x" << document->height);
@@ -480,13 +883,14 @@ void transfer_manager::upload_document(const tgl_input_peer_t& to_id,
     auto u = std::make_shared<upload_task>();
     u->callback = callback;
     u->read_callback = read_callback;
+    u->read_at_callback = read_at_callback;
+    u->resumable = resumable;
     u->part_done_callback = done_callback;
 
     u->size = document->file_size;
 
     u->set_status(tgl_upload_status::waiting);
 
-    static constexpr int MAX_PARTS = 3000; // How do we get this number?
     if (((u->size + MAX_PART_SIZE - 1) / MAX_PART_SIZE) > MAX_PARTS) {
         TGL_ERROR("file is too big");
         u->set_status(tgl_upload_status::failed);
@@ -528,10 +932,30 @@ void transfer_manager::upload_document(const tgl_input_peer_t& to_id,
     u->duration = document->duration;
     u->caption = std::move(document->caption);
 
+    if (!u->read_callback && !u->read_at_callback) {
+        u->source = mapped_file::open(u->file_name);
+        if (!u->source || u->source->size() < u->size) {
+            TGL_ERROR("can not read " << u->size << " bytes from [" << u->file_name << "]");
+            u->set_status(tgl_upload_status::failed);
+            upload_end(u);
+            return;
+        }
+    }
+
+    bool resumed = u->is_resumable() && restore_upload_state(u);
+    if (!resumed) {
+        u->part_size = choose_part_size(message_id, u->size, ua->active_client()->id(), ua->active_client()->max_connections()).part_size;
+    }
     if (u->is_encrypted()) {
-        tgl_secure_random(u->iv.data(), u->iv.size());
-        memcpy(u->init_iv.data(), u->iv.data(), u->iv.size());
-        tgl_secure_random(u->key.data(), u->key.size());
+        if (!resumed) {
+            tgl_secure_random(u->iv.data(), u->iv.size());
+            memcpy(u->init_iv.data(), u->iv.data(), u->iv.size());
+            tgl_secure_random(u->key.data(), u->key.size());
+        }
+        u->aes_key = TGLC_aes_make_key(u->key.data(), 256, 1);
+    }
+    if (u->is_resumable() && !resumed) {
+        u->acknowledged_parts.assign((u->size + u->part_size - 1) / u->part_size, false);
     }
 
     auto thumb_size = document->thumb_data.size();
@@ -543,6 +967,10 @@ void transfer_manager::upload_document(const tgl_input_peer_t& to_id,
 
     m_uploads[message_id] = u;
 
+    if (u->is_resumable() && !resumed) {
+        save_upload_state(u);
+    }
+
     if (!u->is_encrypted() && thumb_size > 0) {
         upload_thumb(u);
         upload_multiple_parts(u, ua->active_client()->max_connections() - 1);
@@ -632,16 +1060,8 @@ void transfer_manager::upload_profile_photo(const std::string& file_name, int32_
             done_callback);
 }
 
-void transfer_manager::upload_document(const tgl_input_peer_t& to_id, int64_t message_id,
-        const std::shared_ptr<tgl_upload_document>& document,
-        tgl_upload_option option,
-        const tgl_upload_callback& callback,
-        const tgl_read_callback& read_callback,
-        const tgl_upload_part_done_callback& done_callback,
-        int32_t reply)
+static bool apply_upload_option(const std::shared_ptr<tgl_upload_document>& document, tgl_upload_option option)
 {
-    TGL_DEBUG("upload_document - file_name: " << document->file_name);
-
     bool as_photo = false;
     if (option == tgl_upload_option::auto_detect_document_type) {
         std::string mime_type = tgl_mime_type_by_filename(document->file_name);
@@ -663,10 +1083,139 @@ void transfer_manager::upload_document(const tgl_input_peer_t& to_id, int64_t me
     } else {
         assert(option == tgl_upload_option::as_document);
     }
+    return as_photo;
+}
+
+void transfer_manager::upload_document(const tgl_input_peer_t& to_id, int64_t message_id,
+        const std::shared_ptr<tgl_upload_document>& document,
+        tgl_upload_option option,
+        const tgl_upload_callback& callback,
+        const tgl_read_callback& read_callback,
+        const tgl_upload_part_done_callback& done_callback,
+        int32_t reply)
+{
+    TGL_DEBUG("upload_document - file_name: " << document->file_name);
 
+    bool as_photo = apply_upload_option(document, option);
     upload_document(to_id, message_id, 0 /* avatar */, reply, as_photo, document, callback, read_callback, done_callback);
 }
 
+void transfer_manager::upload_resumable_document(const tgl_input_peer_t& to_id, int64_t message_id,
+        const std::shared_ptr<tgl_upload_document>& document,
+        tgl_upload_option option,
+        const tgl_upload_callback& callback,
+        const tgl_read_at_callback& read_callback,
+        const tgl_upload_part_done_callback& done_callback,
+        int32_t reply)
+{
+    TGL_DEBUG("upload_resumable_document - file_name: " << document->file_name);
+
+    bool as_photo = apply_upload_option(document, option);
+    upload_document(to_id, message_id, 0 /* avatar */, reply, as_photo, document, callback, nullptr, done_callback, read_callback, true);
+}
+
+bool transfer_manager::restore_upload_state(const std::shared_ptr<upload_task>& u)
+{
+    auto ua = m_user_agent.lock();
+    const auto& storage = ua ? ua->upload_state_storage() : nullptr;
+    if (!storage) {
+        return false;
+    }
+
+    auto state = storage->load_upload_state(u->message_id);
+    if (!state) {
+        return false;
+    }
+
+    // Parts the server already has can't change their size.
+    size_t part_count = is_valid_part_size(state->part_size) ? (u->size + state->part_size - 1) / state->part_size : 0;
+    bool matches = state->file_id && state->size == u->size && part_count && part_count <= MAX_PARTS
+            && state->acknowledged_parts.size() == part_count;
+    if (matches && u->is_encrypted()) {
+        matches = state->key.size() == u->key.size() && state->init_iv.size() == u->init_iv.size()
+                && state->iv.size() == u->iv.size() && state->encrypted_parts <= part_count;
+    } else if (matches) {
+        matches = state->key.empty();
+    }
+    if (!matches) {
+        TGL_WARNING("discarding the upload state of message " << u->message_id << " since it doesn't match the file");
+        storage->remove_upload_state(u->message_id);
+        return false;
+    }
+
+    u->id = state->file_id;
+    u->part_size = state->part_size;
+    u->acknowledged_parts = state->acknowledged_parts;
+    if (u->is_encrypted()) {
+        memcpy(u->key.data(), state->key.data(), u->key.size());
+        memcpy(u->init_iv.data(), state->init_iv.data(), u->init_iv.size());
+        memcpy(u->iv.data(), state->iv.data(), u->iv.size());
+        u->encrypted_parts = state->encrypted_parts;
+        // Everything after the first missing part has to be encrypted and sent
+        // again since the IV of every part depends on the one before.
+        std::fill(u->acknowledged_parts.begin() + u->encrypted_parts, u->acknowledged_parts.end(), false);
+        TGLC_cleanse(state->key.data(), state->key.size());
+        TGLC_cleanse(state->iv.data(), state->iv.size());
+    }
+
+    size_t acknowledged = std::count(u->acknowledged_parts.begin(), u->acknowledged_parts.end(), true);
+    u->uploaded_bytes = std::min(static_cast<uintmax_t>(acknowledged * u->part_size), u->size);
+    TGL_DEBUG("resuming upload of message " << u->message_id << " with " << acknowledged << " of " << part_count << " parts");
+
+    tgl_part_size_choice choice;
+    choice.part_size = u->part_size;
+    choice.part_count = part_count;
+    choice.reason = "the upload is resumed with the parts sent before";
+    report_part_size(u->message_id, choice);
+    return true;
+}
+
+void transfer_manager::save_upload_state(const std::shared_ptr<upload_task>& u)
+{
+    auto ua = m_user_agent.lock();
+    if (!ua || !ua->upload_state_storage() || !u->is_resumable() || !m_uploads.count(u->message_id)) {
+        return;
+    }
+
+    tgl_upload_state state;
+    state.message_id = u->message_id;
+    state.file_id = u->id;
+    state.size = u->size;
+    state.part_size = u->part_size;
+    state.acknowledged_parts = u->acknowledged_parts;
+
+    if (u->is_encrypted()) {
+        size_t first_missing = std::find(u->acknowledged_parts.begin(), u->acknowledged_parts.end(), false)
+                - u->acknowledged_parts.begin();
+        for (auto it = u->part_ivs.begin(); it != u->part_ivs.end() && it->first < first_missing; ) {
+            TGLC_cleanse(it->second.data(), it->second.size());
+            it = u->part_ivs.erase(it);
+        }
+        // A part which hasn't been handed to encryption yet starts with the IV
+        // the last encrypted one left behind.
+        auto it = u->part_ivs.find(first_missing);
+        assert(it != u->part_ivs.end() || first_missing >= u->encrypted_parts);
+        const auto& iv = it != u->part_ivs.end() ? it->second : u->iv;
+        state.key.assign(u->key.begin(), u->key.end());
+        state.init_iv.assign(u->init_iv.begin(), u->init_iv.end());
+        state.iv.assign(iv.begin(), iv.end());
+        state.encrypted_parts = first_missing;
+    }
+
+    ua->upload_state_storage()->store_upload_state(state);
+
+    TGLC_cleanse(state.key.data(), state.key.size());
+    TGLC_cleanse(state.iv.data(), state.iv.size());
+}
+
+void transfer_manager::remove_upload_state(const std::shared_ptr<upload_task>& u)
+{
+    auto ua = m_user_agent.lock();
+    if (ua && ua->upload_state_storage()) {
+        ua->upload_state_storage()->remove_upload_state(u->message_id);
+    }
+}
+
 void transfer_manager::download_end(const std::shared_ptr<download_task>& d)
 {
     auto it = m_downloads.find(d->id);
@@ -677,7 +1226,11 @@ void transfer_manager::download_end(const std::shared_ptr<download_task>& d)
 
     m_downloads.erase(it);
 
-    d->file_stream.reset();
+    d->file.reset();
+
+    if (d->aes_key) {
+        TGL_DEBUG("spent " << d->crypto_time << " seconds decrypting download " << d->id);
+    }
 
     if (d->status != tgl_download_status::downloading && !d->file_name.empty()) {
         boost::system::error_code ec;
@@ -688,10 +1241,150 @@ void transfer_manager::download_end(const std::shared_ptr<download_task>& d)
         d->file_name = std::string();
     } else {
         d->set_status(tgl_download_status::succeeded);
+        add_to_download_cache(d);
     }
 }
 
+bool transfer_manager::download_from_cache(const std::shared_ptr<download_task>& d)
+{
+    int64_t size = 0;
+    std::string path = cached_file_on_disk(d->location, &size);
+    if (path.empty()) {
+        return false;
+    }
+
+    TGL_DEBUG("download " << d->id << " is in the cache at " << path);
+    d->file_name = path;
+    d->downloaded_bytes = size;
+    d->set_status(tgl_download_status::succeeded);
+    return true;
+}
+
+void transfer_manager::add_to_download_cache(const std::shared_ptr<download_task>& d)
+{
+    if (d->file_name.empty()) {
+        return;
+    }
+
+    auto ua = m_user_agent.lock();
+    auto executor = ua ? ua->crypto_executor(d->downloaded_bytes) : nullptr;
+    if (!executor) {
+        m_download_cache->insert(d->location, d->file_name, d->downloaded_bytes, download_cache::hash_file(d->file_name));
+        save_download_cache_later();
+        return;
+    }
+
+    auto hash = std::make_shared<std::string>();
+    std::string path = d->file_name;
+    std::weak_ptr<transfer_manager> weak_this(shared_from_this());
+    executor->execute([hash, path] { *hash = download_cache::hash_file(path); }, [weak_this, d, hash] {
+        if (auto shared_this = weak_this.lock()) {
+            shared_this->m_download_cache->insert(d->location, d->file_name, d->downloaded_bytes, *hash);
+            shared_this->save_download_cache_later();
+        }
+    });
+}
+
 void transfer_manager::download_part_finished(const std::shared_ptr<download_task>& d, size_t offset,
+        double request_time, const tl_ds_upload_file* DS_UF)
+{
+    int32_t dc = d->location.dc();
+    assert(d->parts_in_flight);
+    d->parts_in_flight--;
+    size_t& dc_parts_in_flight = m_download_parts_in_flight[dc];
+    if (dc_parts_in_flight) {
+        dc_parts_in_flight--;
+    }
+    if (DS_UF) {
+        double latency = tgl_get_monotonic_time() - request_time;
+        adapt_download_window(d, latency);
+        if (DS_UF->bytes) {
+            record_part_transfer(dc, DS_UF->bytes->len, latency);
+        }
+    }
+
+    if (DS_UF && !verify_downloaded_part(d, offset, DS_UF)) {
+        int& retries = d->part_retries[offset];
+        if (++retries > MAX_PART_RETRIES) {
+            TGL_ERROR("part at offset " << offset << " of download " << d->id << " keeps failing its hash check");
+            save_downloaded_part(d, offset, nullptr);
+        } else {
+            // Only this part is fetched again, everything else stays as it is.
+            d->parts_to_refetch.push_back(offset);
+        }
+    } else {
+        save_downloaded_part(d, offset, DS_UF);
+    }
+
+    // Whatever happened, a slot on the DC has become free.
+    schedule_download_parts(dc);
+    request_batch_parts(dc);
+}
+
+bool transfer_manager::verify_downloaded_part(const std::shared_ptr<download_task>& d, size_t offset,
+        const tl_ds_upload_file* DS_UF)
+{
+    auto it = d->part_hashes.find(static_cast<int32_t>(offset));
+    if (it == d->part_hashes.end() || !DS_UF->bytes || !DS_UF->bytes->data) {
+        return true;
+    }
+
+    // OpenSSL picks the SHA extensions or AVX2 for this where the CPU has them.
+    unsigned char hash[32];
+    TGLC_sha256(reinterpret_cast<const unsigned char*>(DS_UF->bytes->data), DS_UF->bytes->len, hash);
+    if (memcmp(hash, it->second.data(), sizeof(hash))) {
+        TGL_WARNING("part at offset " << offset << " of download " << d->id << " doesn't match its hash");
+        return false;
+    }
+    return true;
+}
+
+bool transfer_manager::apply_file_hashes(const std::shared_ptr<download_task>& d)
+{
+    auto it = m_file_hashes.find(std::make_pair(d->location.volume(), d->location.local_id()));
+    if (it == m_file_hashes.end()) {
+        return false;
+    }
+
+    std::vector<tgl_file_hash> hashes = std::move(it->second);
+    m_file_hashes.erase(it);
+
+    if (hashes.empty() || d->size <= 0) {
+        return false;
+    }
+
+    int32_t part_size = hashes.front().limit;
+    if (!is_valid_part_size(part_size)) {
+        TGL_WARNING("not verifying download " << d->id << " with hashes over " << part_size << " byte ranges");
+        return false;
+    }
+    for (const auto& hash: hashes) {
+        if (hash.limit != part_size || hash.offset % part_size) {
+            TGL_WARNING("not verifying download " << d->id << " with hashes over uneven ranges");
+            return false;
+        }
+    }
+
+    d->part_size = part_size;
+    for (const auto& hash: hashes) {
+        d->part_hashes[hash.offset] = hash.hash;
+    }
+    TGL_DEBUG("verifying download " << d->id << " against " << hashes.size() << " hashes");
+
+    tgl_part_size_choice choice;
+    choice.part_size = part_size;
+    choice.part_count = (d->size + part_size - 1) / part_size;
+    choice.reason = "the parts have to match the ranges of the file hashes";
+    report_part_size(d->id, choice);
+    return true;
+}
+
+void transfer_manager::set_file_hashes(const tgl_file_location& location, const std::vector<tgl_file_hash>& hashes)
+{
+    m_file_hashes[std::make_pair(location.volume(), location.local_id())] = hashes;
+}
+
+void transfer_manager::save_downloaded_part(const std::shared_ptr<download_task>& d, size_t offset,
         const tl_ds_upload_file* DS_UF)
 {
     if (!DS_UF || d->check_cancelled()) {
@@ -703,10 +1396,9 @@ void transfer_manager::download_part_finished(const std::shared_ptr<download_tas
         return;
     }
 
-    if (!d->file_stream) {
-        d->file_stream = std::make_unique<std::ofstream>(d->file_name, std::ios_base::trunc | std::ios_base::out | std::ios_base::binary);
-        if (!d->file_stream || !d->file_stream->good()) {
-            TGL_ERROR("can not open file [" << d->file_name << "] for writing");
+    if (!d->file) {
+        d->file = positional_file::create(d->file_name, d->size);
+        if (!d->file) {
             d->set_status(tgl_download_status::failed);
             d->running_parts.clear();
             download_end(d);
@@ -724,37 +1416,35 @@ void transfer_manager::download_part_finished(const std::shared_ptr<download_tas
 
     if (!d->iv.empty()) {
         d->running_parts[offset] = download_data(DS_UF->bytes->data, DS_UF->bytes->len, false);
-        auto it = d->running_parts.begin();
-        for (;it != d->running_parts.end() && d->decryption_offset == it->first && it->second; ++it) {
-            char* data = it->second.data();
-            size_t length = it->second.length();
-            if (length & 15) {
-                TGL_ERROR("the encrypted data length is not half byte aligned");
-                assert(false);
-                d->set_status(tgl_download_status::failed);
-                d->running_parts.clear();
-                download_end(d);
-            }
-            TGLC_aes_key aes_key;
-            TGLC_aes_set_decrypt_key(d->key.data(), 256, &aes_key);
-            TGLC_aes_ige_encrypt(reinterpret_cast<const unsigned char*>(data),
-                    reinterpret_cast<unsigned char*>(data), length, &aes_key, d->iv.data(), 0);
-            memset(&aes_key, 0, sizeof(aes_key));
-            if (length > d->size - it->first) {
-                length = d->size - it->first;
-            }
-            d->file_stream->seekp(it->first);
-            d->file_stream->write(data, length);
-            d->decryption_offset += length;
+        if (!decrypt_downloaded_parts(d)) {
+            return;
         }
-        if (it == d->running_parts.begin()) {
-            d->running_parts[offset] = download_data(DS_UF->bytes->data, DS_UF->bytes->len, true);
-        } else {
-            d->running_parts.erase(d->running_parts.begin(), it);
+        auto it = d->running_parts.find(offset);
+        if (it != d->running_parts.end() && it->second && !it->second.owns_data()) {
+            // It has to wait for an earlier part, so it needs a copy of its own
+            // or, once too much is waiting already, a place in the file.
+            size_t length = DS_UF->bytes->len;
+            if (d->buffered_bytes + length > MAX_REASSEMBLY_BYTES) {
+                if (!d->file->write(DS_UF->bytes->data, length, offset)) {
+                    d->set_status(tgl_download_status::failed);
+                    d->running_parts.clear();
+                    download_end(d);
+                    return;
+                }
+                d->spilled_parts[offset] = length;
+                it->second = download_data();
+            } else {
+                it->second = download_data(DS_UF->bytes->data, length, true);
+                d->buffered_bytes += length;
+            }
         }
     } else {
-        d->file_stream->seekp(offset);
-        d->file_stream->write(DS_UF->bytes->data, DS_UF->bytes->len);
+        if (!d->file->write(DS_UF->bytes->data, DS_UF->bytes->len, offset)) {
+            d->set_status(tgl_download_status::failed);
+            d->running_parts.clear();
+            download_end(d);
+            return;
+        }
         d->running_parts.erase(offset);
     }
 
@@ -764,20 +1454,225 @@ void transfer_manager::download_part_finished(const std::shared_ptr<download_tas
         d->set_status(tgl_download_status::downloading);
     }
 
-    if (d->offset < d->size) {
-        download_part(d);
-    } else if (d->running_parts.empty()) {
+    if (d->offset >= d->size && d->running_parts.empty()) {
         download_end(d);
     }
 }
 
-void transfer_manager::download_multiple_parts(const std::shared_ptr<download_task>& d, size_t count)
+bool transfer_manager::decrypt_downloaded_parts(const std::shared_ptr<download_task>& d)
 {
-    for (size_t i = 0; d->offset < d->size && i < count; ++i) {
+    std::shared_ptr<download_parts_decryption> job;
+    size_t job_size = 0;
+    crypto_executor* executor = nullptr;
+    while (!d->decrypting) {
+        job = std::make_shared<download_parts_decryption>();
+        job_size = 0;
+        size_t next_offset = d->decryption_offset;
+        for (auto it = d->running_parts.find(next_offset); it != d->running_parts.end() && it->first == next_offset
+                && job_size < MAX_REASSEMBLY_BYTES; ++it) {
+            download_data data;
+            auto spilled = d->spilled_parts.find(next_offset);
+            if (it->second) {
+                if (it->second.owns_data()) {
+                    d->buffered_bytes -= it->second.length();
+                }
+                data = std::move(it->second);
+                it->second = download_data();
+            } else if (spilled != d->spilled_parts.end()) {
+                data = download_data(spilled->second);
+                if (!d->file->read(data.data(), data.length(), next_offset)) {
+                    d->set_status(tgl_download_status::failed);
+                    d->running_parts.clear();
+                    download_end(d);
+                    return false;
+                }
+                d->spilled_parts.erase(spilled);
+            } else {
+                break;
+            }
+            next_offset += data.length();
+            job_size += data.length();
+            job->parts.emplace_back(it->first, std::move(data));
+        }
+
+        if (job->parts.empty()) {
+            return true;
+        }
+
+        job->aes_key = d->aes_key;
+        job->iv = d->iv;
+
+        auto ua = m_user_agent.lock();
+        executor = ua ? ua->crypto_executor(job_size) : nullptr;
+        if (executor) {
+            break;
+        }
+
+        job->run();
+        if (!finish_decryption(d, *job)) {
+            return false;
+        }
+    }
+
+    if (!executor) {
+        return true;
+    }
+
+    // The parts left behind in running_parts are empty now, so nobody else
+    // touches them and the download can't finish before they are written.
+    for (auto& part: job->parts) {
+        if (!part.second.owns_data()) {
+            part.second = download_data(part.second.data(), part.second.length(), true);
+        }
+    }
+
+    d->decrypting = true;
+    std::weak_ptr<transfer_manager> weak_this(shared_from_this());
+    executor->execute([job] { job->run(); }, [weak_this, d, job] {
+        d->decrypting = false;
+        auto shared_this = weak_this.lock();
+        if (!shared_this || !d->file) {
+            // The download has ended in the meantime.
+            return;
+        }
+        if (!shared_this->finish_decryption(d, *job) || !shared_this->decrypt_downloaded_parts(d)) {
+            return;
+        }
+        if (d->offset >= d->size && d->running_parts.empty()) {
+            shared_this->download_end(d);
+        }
+    });
+
+    return true;
+}
+
+bool transfer_manager::finish_decryption(const std::shared_ptr<download_task>& d, download_parts_decryption& job)
+{
+    d->iv = job.iv;
+    d->crypto_time += job.crypto_time;
+
+    if (job.misaligned) {
+        TGL_ERROR("the encrypted data length is not half byte aligned");
+        assert(false);
+        d->set_status(tgl_download_status::failed);
+        d->running_parts.clear();
+        download_end(d);
+        return false;
+    }
+
+    for (const auto& part: job.parts) {
+        size_t length = part.second.length();
+        if (length > d->size - part.first) {
+            length = d->size - part.first;
+        }
+        // The padding of the last part may have been put aside in the file too.
+        if (!d->file->write(part.second.data(), length, part.first)
+                || (length < part.second.length() && !d->file->truncate(d->size))) {
+            d->set_status(tgl_download_status::failed);
+            d->running_parts.clear();
+            download_end(d);
+            return false;
+        }
+        d->decryption_offset += length;
+        d->running_parts.erase(part.first);
+    }
+
+    return true;
+}
+
+void transfer_manager::schedule_download_parts(const std::shared_ptr<download_task>& d)
+{
+    size_t& dc_parts_in_flight = m_download_parts_in_flight[d->location.dc()];
+    size_t window = std::max(static_cast<size_t>(d->window), static_cast<size_t>(1));
+    while ((d->offset < d->size || !d->parts_to_refetch.empty()) && d->parts_in_flight < window
+            && dc_parts_in_flight < m_max_download_parts_per_dc && m_downloads.count(d->id)) {
+        if (!admit_download_part(d)) {
+            break;
+        }
         download_part(d);
     }
 }
 
+bool transfer_manager::admit_download_part(const std::shared_ptr<download_task>& d)
+{
+    return m_scheduler.admit(d->share, d->part_size, [this, d] {
+        if (m_downloads.count(d->id)) {
+            schedule_download_parts(d);
+        }
+    });
+}
+
+bool transfer_manager::admit_upload_part(const std::shared_ptr<upload_task>& u)
+{
+    bool admitted = m_scheduler.admit(u->share, u->part_size, [this, u] {
+        size_t parts = u->throttled_parts;
+        u->throttled_parts = 0;
+        for (size_t i = 0; i < parts && m_uploads.count(u->message_id); ++i) {
+            upload_part(u);
+        }
+    });
+    if (!admitted) {
+        u->throttled_parts++;
+    }
+    return admitted;
+}
+
+void transfer_manager::set_rate_limit(uint64_t bytes_per_second)
+{
+    m_scheduler.set_rate_limit(bytes_per_second);
+}
+
+void transfer_manager::set_download_share(int64_t download_id, uint64_t max_bytes_per_second, double weight)
+{
+    auto it = m_downloads.find(download_id);
+    if (it == m_downloads.end()) {
+        TGL_DEBUG("can't find download " << download_id);
+        return;
+    }
+    m_scheduler.set_share(it->second->share, max_bytes_per_second, weight);
+}
+
+void transfer_manager::set_upload_share(int64_t message_id, uint64_t max_bytes_per_second, double weight)
+{
+    auto it = m_uploads.find(message_id);
+    if (it == m_uploads.end()) {
+        TGL_DEBUG("can't find upload " << message_id);
+        return;
+    }
+    m_scheduler.set_share(it->second->share, max_bytes_per_second, weight);
+}
+
+void transfer_manager::schedule_download_parts(int32_t dc)
+{
+    // Make a copy since requesting a part can end a download.
+    std::vector<std::shared_ptr<download_task>> downloads;
+    for (const auto& it: m_downloads) {
+        if (it.second->location.dc() == dc) {
+            downloads.push_back(it.second);
+        }
+    }
+    for (const auto& d: downloads) {
+        schedule_download_parts(d);
+    }
+}
+
+void transfer_manager::adapt_download_window(const std::shared_ptr<download_task>& d, double part_latency)
+{
+    if (!d->min_part_latency || part_latency < d->min_part_latency) {
+        d->min_part_latency = part_latency;
+    }
+    d->part_latency = d->part_latency ? d->part_latency * 0.8 + part_latency * 0.2 : part_latency;
+
+    // Grow by about one part per round trip while parts come back about as
+    // fast as they ever did and shrink the same way once they start queueing
+    // up somewhere on the way.
+    if (d->part_latency < d->min_part_latency * 1.5) {
+        d->window = std::min(d->window + 1 / d->window, static_cast<double>(m_max_download_parts_per_file));
+    } else if (d->part_latency > d->min_part_latency * 3) {
+        d->window = std::max(d->window - 1 / d->window, 1.0);
+    }
+}
+
 void transfer_manager::download_part(const std::shared_ptr<download_task>& d)
 {
     TGL_DEBUG("download_part from offset " << d->offset << "(file size " << d->size << ")");
@@ -791,7 +1686,7 @@ void transfer_manager::download_part(const std::shared_ptr<download_task>& d)
         return;
     }
 
-    if (!d->offset) {
+    if (d->file_name.empty()) {
         std::string path = get_file_path(d->location.access_hash());
         if (!d->ext.empty()) {
             path += std::string(".") + d->ext;
@@ -799,10 +1694,20 @@ void transfer_manager::download_part(const std::shared_ptr<download_task>& d)
         d->file_name = path;
     }
 
-    d->running_parts[d->offset] = download_data();
+    int32_t offset = d->offset;
+    if (!d->parts_to_refetch.empty()) {
+        offset = d->parts_to_refetch.front();
+        d->parts_to_refetch.pop_front();
+    } else {
+        d->offset += d->part_size;
+    }
+
+    d->running_parts[offset] = download_data();
+    d->parts_in_flight++;
+    m_download_parts_in_flight[d->location.dc()]++;
 
     auto q = std::make_shared<query_download_file_part>(*ua, d, std::bind(&transfer_manager::download_part_finished,
-            shared_from_this(), d, d->offset, std::placeholders::_1));
+            shared_from_this(), d, offset, tgl_get_monotonic_time(), std::placeholders::_1));
 
     q->out_i32(CODE_upload_get_file);
     if (d->location.local_id()) {
@@ -815,9 +1720,8 @@ void transfer_manager::download_part(const std::shared_ptr<download_task>& d)
         q->out_i64(d->location.document_id());
         q->out_i64(d->location.access_hash());
     }
-    q->out_i32(d->offset);
-    q->out_i32(MAX_PART_SIZE);
-    d->offset += MAX_PART_SIZE;
+    q->out_i32(offset);
+    q->out_i32(d->part_size);
 
     q->execute(ua->client_at(d->location.dc()));
 }
@@ -855,12 +1759,20 @@ void transfer_manager::download_by_file_location(int64_t download_id,
 
     auto d = std::make_shared<download_task>(download_id, file_size, file_location);
     d->callback = callback;
+    if (download_from_cache(d)) {
+        return;
+    }
     m_downloads[d->id] = d;
     d->set_status(tgl_download_status::waiting);
+    size_t parallelism = std::min(ua->client_at(d->location.dc())->max_connections(), m_max_download_parts_per_file);
+    if (!apply_file_hashes(d)) {
+        d->part_size = choose_part_size(d->id, file_size, d->location.dc(), parallelism).part_size;
+    }
     if (file_size <= 0) { // It's likely for avatar which doesn't have a file size
         download_part(d);
     } else {
-        download_multiple_parts(d, ua->client_at(d->location.dc())->max_connections());
+        d->window = std::min(ua->client_at(d->location.dc())->max_connections(), m_max_download_parts_per_file);
+        schedule_download_parts(d);
     }
 }
 
@@ -894,12 +1806,20 @@ void transfer_manager::download_document(int64_t download_id,
         return;
     }
 
+    if (download_from_cache(d)) {
+        return;
+    }
+
     m_downloads[d->id] = d;
     if (!document->mime_type.empty()) {
         d->ext = tgl_extension_by_mime_type(document->mime_type);
     }
     d->set_status(tgl_download_status::waiting);
-    download_multiple_parts(d, ua->client_at(d->location.dc())->max_connections());
+    d->window = std::min(ua->client_at(d->location.dc())->max_connections(), m_max_download_parts_per_file);
+    if (!apply_file_hashes(d)) {
+        d->part_size = choose_part_size(d->id, d->size, d->location.dc(), static_cast<size_t>(d->window)).part_size;
+    }
+    schedule_download_parts(d);
 }
 
 void transfer_manager::cancel_download(int64_t download_id)
@@ -913,6 +1833,194 @@ void transfer_manager::cancel_download(int64_t download_id)
     TGL_DEBUG("download " << download_id << " has been cancelled");
 }
 
+void transfer_manager::download_batch(const std::vector<tgl_file_location>& locations,
+        const tgl_batch_download_callback& callback)
+{
+    auto b = std::make_shared<batch_download>();
+    b->items.resize(locations.size());
+    b->results.resize(locations.size());
+    b->callback = callback;
+
+    std::set<int32_t> dcs;
+    for (size_t i = 0; i < locations.size(); ++i) {
+        auto& result = b->results[i];
+        result.location = locations[i];
+        int64_t size = 0;
+        result.file_name = cached_file_on_disk(locations[i], &size);
+        if (!result.file_name.empty()) {
+            result.status = tgl_download_status::succeeded;
+            continue;
+        }
+        if (!locations[i].dc()) {
+            TGL_ERROR("bad file location in batch download");
+            continue;
+        }
+        b->queued_items[locations[i].dc()].push_back(i);
+        dcs.insert(locations[i].dc());
+        b->remaining++;
+    }
+
+    TGL_DEBUG("batch download of " << locations.size() << " files, " << b->remaining << " of them from " << dcs.size() << " DCs");
+
+    if (!b->remaining) {
+        if (b->callback) {
+            b->callback(b->results);
+        }
+        return;
+    }
+
+    m_batch_downloads.push_back(b);
+    for (int32_t dc: dcs) {
+        request_batch_parts(dc);
+    }
+}
+
+void transfer_manager::request_batch_parts(int32_t dc)
+{
+    // Make a copy since a failed request can finish a batch.
+    auto batches = m_batch_downloads;
+    const size_t& dc_parts_in_flight = m_download_parts_in_flight[dc];
+    for (const auto& b: batches) {
+        auto it = b->queued_items.find(dc);
+        while (it != b->queued_items.end() && !it->second.empty() && dc_parts_in_flight < m_max_download_parts_per_dc) {
+            // Each request may bring a whole part, what it doesn't is given
+            // back when the answer arrives.
+            bool admitted = m_scheduler.admit(b->share, MAX_PART_SIZE, [this, b] {
+                std::vector<int32_t> dcs;
+                for (const auto& it: b->queued_items) {
+                    dcs.push_back(it.first);
+                }
+                for (int32_t dc: dcs) {
+                    request_batch_parts(dc);
+                }
+            });
+            if (!admitted) {
+                return;
+            }
+
+            size_t index = it->second.front();
+            it->second.pop_front();
+            request_batch_part(b, index);
+        }
+    }
+}
+
+void transfer_manager::request_batch_part(const std::shared_ptr<batch_download>& b, size_t index)
+{
+    auto ua = m_user_agent.lock();
+    if (!ua) {
+        TGL_ERROR("the user agent has gone");
+        finish_batch_item(b, index, false);
+        return;
+    }
+
+    const tgl_file_location& location = b->results[index].location;
+    m_download_parts_in_flight[location.dc()]++;
+
+    auto q = std::make_shared<query_download_file_part>(*ua, nullptr, std::bind(&transfer_manager::batch_part_finished,
+            shared_from_this(), b, index, std::placeholders::_1));
+    q->out_i32(CODE_upload_get_file);
+    if (location.local_id()) {
+        q->out_i32(CODE_input_file_location);
+        q->out_i64(location.volume());
+        q->out_i32(location.local_id());
+        q->out_i64(location.secret());
+    } else {
+        q->out_i32(CODE_input_document_file_location);
+        q->out_i64(location.document_id());
+        q->out_i64(location.access_hash());
+    }
+    q->out_i32(b->items[index].data.size());
+    q->out_i32(MAX_PART_SIZE);
+
+    q->execute(ua->client_at(location.dc()));
+}
+
+void transfer_manager::batch_part_finished(const std::shared_ptr<batch_download>& b, size_t index,
+        const tl_ds_upload_file* DS_UF)
+{
+    int32_t dc = b->results[index].location.dc();
+    size_t& in_flight = m_download_parts_in_flight[dc];
+    if (in_flight) {
+        in_flight--;
+    }
+
+    size_t received = DS_UF && DS_UF->bytes && DS_UF->bytes->len > 0 ? static_cast<size_t>(DS_UF->bytes->len) : 0;
+    if (received < MAX_PART_SIZE) {
+        m_scheduler.refund(b->share, MAX_PART_SIZE - received);
+    }
+
+    auto& item = b->items[index];
+    if (!DS_UF || !DS_UF->bytes || DS_UF->bytes->len < 0 || (item.data.empty() && !DS_UF->bytes->len)) {
+        finish_batch_item(b, index, false);
+    } else {
+        item.data.append(DS_UF->bytes->data, DS_UF->bytes->len);
+        if (static_cast<size_t>(DS_UF->bytes->len) == MAX_PART_SIZE) {
+            // There may be more of it, it goes on when its turn comes again.
+            b->queued_items[dc].push_back(index);
+        } else {
+            finish_batch_item(b, index, true);
+        }
+    }
+
+    request_batch_parts(dc);
+    schedule_download_parts(dc);
+}
+
+void transfer_manager::finish_batch_item(const std::shared_ptr<batch_download>& b, size_t index, bool success)
+{
+    auto& result = b->results[index];
+    std::string data = std::move(b->items[index].data);
+    b->items[index].data = std::string();
+
+    if (success) {
+        std::string path = get_file_path(result.location.access_hash());
+        auto file = positional_file::create(path, data.size());
+        if (file && file->write(data.data(), data.size(), 0)) {
+            result.status = tgl_download_status::succeeded;
+            result.file_name = path;
+            m_download_cache->insert(result.location, path, data.size(),
+                    download_cache::hash_data(reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+            save_download_cache_later();
+        }
+    }
+
+    assert(b->remaining);
+    if (--b->remaining) {
+        return;
+    }
+
+    m_batch_downloads.erase(std::remove(m_batch_downloads.begin(), m_batch_downloads.end(), b), m_batch_downloads.end());
+    if (b->callback) {
+        b->callback(b->results);
+    }
+}
+
+void transfer_manager::set_download_concurrency(size_t max_parts_per_file, size_t max_parts_per_dc)
+{
+    m_max_download_parts_per_file = std::max(max_parts_per_file, static_cast<size_t>(1));
+    m_max_download_parts_per_dc = std::max(max_parts_per_dc, static_cast<size_t>(1));
+
+    std::vector<std::shared_ptr<download_task>> downloads;
+    for (const auto& it: m_downloads) {
+        it.second->window = std::min(it.second->window, static_cast<double>(m_max_download_parts_per_file));
+        downloads.push_back(it.second);
+    }
+    for (const auto& d: downloads) {
+        schedule_download_parts(d);
+    }
+
+    std::set<int32_t> dcs;
+    for (const auto& b: m_batch_downloads) {
+        for (const auto& it: b->queued_items) {
+            dcs.insert(it.first);
+        }
+    }
+    for (int32_t dc: dcs) {
+        request_batch_parts(dc);
+    }
+}
+
 void transfer_manager::cancel_upload(int64_t message_id)
 {
     auto it = m_uploads.find(message_id);
@@ -21,37 +21,56 @@
 
 #pragma once
 
+#include "rate_limiter.h"
 #include "tgl/tgl_transfer_manager.h"
 
+#include <cstdint>
 #include <memory>
 #include <map>
 
+class tgl_timer;
+
 namespace tgl {
 namespace impl {
 
+class download_cache;
+struct batch_download;
 class download_task;
 class query_download_file_part;
 class query_upload_file_part;
 class upload_task;
 class user_agent;
+struct download_parts_decryption;
 struct tl_ds_upload_file;
 
 class transfer_manager: public std::enable_shared_from_this<transfer_manager>, public tgl_transfer_manager
 {
 public:
-    transfer_manager(const std::weak_ptr<user_agent>& weak_ua, const std::string& download_directory)
-        : m_user_agent(weak_ua)
-        , m_download_directory(download_directory)
-    { }
+    transfer_manager(const std::weak_ptr<user_agent>& weak_ua, const std::string& download_directory);
+    ~transfer_manager();
 
     virtual std::string download_directory() const override { return m_download_directory; }
     virtual bool file_exists(const tgl_file_location &location) const override;
     virtual std::string get_file_path(int64_t secret) const override;
+    virtual std::string cached_file_path(const tgl_file_location& location) override;
+    virtual void set_download_cache_budget(uint64_t bytes) override;
     virtual void download_by_file_location(int64_t download_id, const tgl_file_location& location,
             int32_t file_size, const tgl_download_callback& callback) override;
     virtual void download_document(int64_t download_id, const std::shared_ptr<tgl_download_document>& document,
             const tgl_download_callback& callback) override;
     virtual void cancel_download(int64_t download_id) override;
+    virtual void download_batch(const std::vector<tgl_file_location>& locations,
+            const tgl_batch_download_callback& callback) override;
+    virtual void set_file_hashes(const tgl_file_location& location, const std::vector<tgl_file_hash>& hashes) override;
+    virtual void set_download_concurrency(size_t max_parts_per_file, size_t max_parts_per_dc) override;
+    virtual void set_rate_limit(uint64_t bytes_per_second) override;
+    virtual void set_download_share(int64_t download_id, uint64_t max_bytes_per_second, double weight) override;
+    virtual void set_upload_share(int64_t message_id, uint64_t max_bytes_per_second, double weight) override;
+    virtual void set_part_size_callback(const tgl_part_size_callback& callback) override { m_part_size_callback = callback; }
+    virtual void set_upload_stage_times_callback(const tgl_upload_stage_times_callback& callback) override
+    {
+        m_upload_stage_times_callback = callback;
+    }
     virtual void upload_document(const tgl_input_peer_t& to_id, int64_t message_id,
             const std::shared_ptr<tgl_upload_document>& document,
             tgl_upload_option option,
@@ -59,6 +78,13 @@ public:
             const tgl_read_callback& read_callback,
             const tgl_upload_part_done_callback& part_done_callback,
             int32_t reply = 0) override;
+    virtual void upload_resumable_document(const tgl_input_peer_t& to_id, int64_t message_id,
+            const std::shared_ptr<tgl_upload_document>& document,
+            tgl_upload_option option,
+            const tgl_upload_callback& callback,
+            const tgl_read_at_callback& read_callback,
+            const tgl_upload_part_done_callback& part_done_callback,
+            int32_t reply = 0) override;
     virtual void upload_profile_photo(const std::string &file_name, int32_t file_size,
             const std::function<void(bool success)>& callback,
             const tgl_read_callback& read_callback,
@@ -76,6 +102,22 @@ public:
     virtual bool is_downloading_file(int64_t download_id) const override;
 
 private:
+    // What the parts transferred so far tell about a DC.
+    struct dc_transfer_stats
+    {
+        double min_part_latency = 0;
+        double throughput = 0; // bytes per second and connection, smoothed
+    };
+
+    tgl_part_size_choice choose_part_size(int64_t transfer_id, int64_t file_size, int32_t dc, size_t parallelism) const;
+    void report_part_size(int64_t transfer_id, const tgl_part_size_choice& choice) const;
+    void record_part_transfer(int32_t dc, size_t bytes, double latency);
+
+    // Both return false and queue the transfer until the rate limits let its
+    // next part through.
+    bool admit_download_part(const std::shared_ptr<download_task>&);
+    bool admit_upload_part(const std::shared_ptr<upload_task>&);
+
     void upload_part_finished(const std::shared_ptr<upload_task>&u, size_t part_number, bool success);
 
     void upload_avatar_end(const std::shared_ptr<upload_task>&, const std::function<void(bool)>& callback);
@@ -86,30 +128,80 @@ private:
 
     void upload_multiple_parts(const std::shared_ptr<upload_task>& u, size_t count);
     void upload_part(const std::shared_ptr<upload_task>&);
+    void encrypt_upload_parts(const std::shared_ptr<upload_task>&);
+    void send_upload_part(user_agent& ua, const std::shared_ptr<upload_task>&, size_t part_num,
+            const std::shared_ptr<query_upload_file_part>&);
+
+    // Resumable uploads only. restore_upload_state() returns true if the
+    // upload resumes, keeping the part size it was started with.
+    bool restore_upload_state(const std::shared_ptr<upload_task>&);
+    void save_upload_state(const std::shared_ptr<upload_task>&);
+    void remove_upload_state(const std::shared_ptr<upload_task>&);
 
     void upload_document(const tgl_input_peer_t& to_id,
             int64_t message_id, int32_t avatar, int32_t reply, bool as_photo,
             const std::shared_ptr<tgl_upload_document>& document,
             const tgl_upload_callback& callback,
             const tgl_read_callback& read_callback,
-            const tgl_upload_part_done_callback& part_done_callback);
+            const tgl_upload_part_done_callback& part_done_callback,
+            const tgl_read_at_callback& read_at_callback = nullptr,
+            bool resumable = false);
 
     void upload_photo(const tgl_input_peer_t& chat_id, const std::string &file_name, int32_t file_size,
                       const std::function<void(bool success)>& callback,
                       const tgl_read_callback& read_callback,
                       const tgl_upload_part_done_callback& done_callback);
 
-    void download_part_finished(const std::shared_ptr<download_task>&, size_t offset, const tl_ds_upload_file*);
-
-    void download_multiple_parts(const std::shared_ptr<download_task>&, size_t count);
+    void download_part_finished(const std::shared_ptr<download_task>&, size_t offset, double request_time, const tl_ds_upload_file*);
+    // Returns false if the part doesn't match its hash.
+    bool verify_downloaded_part(const std::shared_ptr<download_task>&, size_t offset, const tl_ds_upload_file*);
+    // Returns true if the hashes fixed the part size of the download.
+    bool apply_file_hashes(const std::shared_ptr<download_task>&);
+    void save_downloaded_part(const std::shared_ptr<download_task>&, size_t offset, const tl_ds_upload_file*);
+    // Both return false if the download has failed and been ended.
+    bool decrypt_downloaded_parts(const std::shared_ptr<download_task>&);
+    bool finish_decryption(const std::shared_ptr<download_task>&, download_parts_decryption&);
+
+    // Requests as many parts as the window of the download and its DC allow.
+    void schedule_download_parts(const std::shared_ptr<download_task>&);
+    void schedule_download_parts(int32_t dc);
+    void adapt_download_window(const std::shared_ptr<download_task>&, double part_latency);
     void download_part(const std::shared_ptr<download_task>&);
     void download_end(const std::shared_ptr<download_task>&);
+    // Completes the download from the cache if its location is there.
+    bool download_from_cache(const std::shared_ptr<download_task>&);
+    // Like download_cache::lookup() but makes sure the file is still there,
+    // dropping the entry if it isn't.
+    std::string cached_file_on_disk(const tgl_file_location&, int64_t* size = nullptr) const;
+    void add_to_download_cache(const std::shared_ptr<download_task>&);
+    // Writes the download cache index a little later, so that a burst of
+    // changes costs one write.
+    void save_download_cache_later() const;
+
+    // Requests the queued parts of batch downloads on the DC as far as the
+    // per DC cap on parts in flight and the rate limit allow.
+    void request_batch_parts(int32_t dc);
+    void request_batch_part(const std::shared_ptr<batch_download>&, size_t index);
+    void batch_part_finished(const std::shared_ptr<batch_download>&, size_t index, const tl_ds_upload_file*);
+    void finish_batch_item(const std::shared_ptr<batch_download>&, size_t index, bool success);
 
 private:
     std::weak_ptr<user_agent> m_user_agent;
     std::string m_download_directory;
+    std::unique_ptr<download_cache> m_download_cache;
+    mutable std::shared_ptr<tgl_timer> m_download_cache_timer;
+    mutable bool m_download_cache_save_pending;
     std::map<int64_t, std::shared_ptr<download_task>> m_downloads;
     std::map<int64_t, std::shared_ptr<upload_task>> m_uploads;
+    std::map<int32_t, size_t> m_download_parts_in_flight; // by DC
+    std::vector<std::shared_ptr<batch_download>> m_batch_downloads;
+    std::map<int32_t, dc_transfer_stats> m_dc_transfer_stats;
+    std::map<std::pair<int64_t, int32_t>, std::vector<tgl_file_hash>> m_file_hashes; // by volume and local id
+    tgl_part_size_callback m_part_size_callback;
+    tgl_upload_stage_times_callback m_upload_stage_times_callback;
+    size_t m_max_download_parts_per_file;
+    size_t m_max_download_parts_per_dc;
+    transfer_scheduler m_scheduler;
 };
 
 static constexpr size_t BIG_FILE_THRESHOLD = 10 * 1024 * 1024;
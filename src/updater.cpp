@@ -24,13 +24,13 @@
 #include "auto/auto.h"
 #include "auto/auto_types.h"
 #include "auto/auto_fetch_ds.h"
-#include "auto/auto_free_ds.h"
 #include "chat.h"
 #include "file_location.h"
 #include "message.h"
 #include "mtproto_common.h"
 #include "peer_id.h"
 #include "secret_chat.h"
+#include "tl_ds_arena.h"
 #include "tgl/tgl_log.h"
 #include "tgl/tgl_update_callback.h"
 #include "typing_status.h"
@@ -220,6 +220,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
     case CODE_update_user_status:
         {
             tgl_user_status status = create_user_status(DS_U->status);
+            m_user_agent.peer_updated(tgl_peer_id_t(tgl_peer_type::user, DS_LVAL(DS_U->user_id)));
             m_user_agent.callback()->status_notification(DS_LVAL(DS_U->user_id), status);
         }
         break;
@@ -230,6 +231,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
             updates.emplace(tgl_user_update_type::username, DS_STDSTR(DS_U->username));
             updates.emplace(tgl_user_update_type::firstname, DS_STDSTR(DS_U->first_name));
             updates.emplace(tgl_user_update_type::lastname, DS_STDSTR(DS_U->last_name));
+            m_user_agent.peer_updated(tgl_peer_id_t(tgl_peer_type::user, user_id));
             m_user_agent.callback()->user_update(user_id, updates);
         }
         break;
@@ -237,6 +239,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
         if (DS_U->photo) {
             tgl_file_location photo_big = create_file_location(DS_U->photo->photo_big);
             tgl_file_location photo_small = create_file_location(DS_U->photo->photo_small);
+            m_user_agent.peer_updated(tgl_peer_id_t(tgl_peer_type::user, DS_LVAL(DS_U->user_id)));
             m_user_agent.callback()->avatar_update(DS_LVAL(DS_U->user_id), tgl_peer_type::user, photo_small, photo_big);
         }
         break;
@@ -259,6 +262,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
                     participants.push_back(participant);
                 }
             }
+            m_user_agent.peer_updated(chat_id);
             m_user_agent.callback()->chat_update_participants(chat_id.peer_id, participants);
         }
         break;
@@ -308,6 +312,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
             participant->user_id = user_id.peer_id;
             participant->inviter_id = inviter_id.peer_id;
             participant->date = tgl_get_system_time();
+            m_user_agent.peer_updated(chat_id);
             m_user_agent.callback()->chat_update_participants(chat_id.peer_id, { participant });
         }
         break;
@@ -318,6 +323,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
             //int version = DS_LVAL(DS_U->version);
 
             //bl_do_chat_del_user(C->id, version, user_id.peer_id);
+            m_user_agent.peer_updated(chat_id);
             m_user_agent.callback()->chat_delete_user(chat_id.peer_id, user_id.peer_id);
         }
         break;
@@ -336,6 +342,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
 
             std::map<tgl_user_update_type, std::string> updates;
             updates.emplace(tgl_user_update_type::blocked, blocked ? "Yes" : "No");
+            m_user_agent.peer_updated(tgl_peer_id_t(tgl_peer_type::user, peer_id));
             m_user_agent.callback()->user_update(peer_id, updates);
         }
         break;
@@ -392,6 +399,7 @@ void updater::work_update(const tl_ds_update* DS_U, const update_context& contex
             int32_t peer_id = DS_LVAL(DS_U->user_id);
             std::map<tgl_user_update_type, std::string> updates;
             updates.emplace(tgl_user_update_type::phone, DS_STDSTR(DS_U->phone));
+            m_user_agent.peer_updated(tgl_peer_id_t(tgl_peer_type::user, peer_id));
             m_user_agent.callback()->user_update(peer_id, updates);
         }
         break;
@@ -716,14 +724,14 @@ void updater::work_any_updates(const tl_ds_updates* DS_U, const update_context&
 void updater::work_any_updates(tgl_in_buffer* in, const update_context& context)
 {
     paramed_type type = TYPE_TO_PARAM(updates);
-    tl_ds_updates* DS_U = fetch_ds_type_updates(in, &type);
+    tl_ds_arena arena;
+    tl_ds_updates* DS_U = fetch_ds_type_updates(in, &type, &arena);
     if (!DS_U) {
         TGL_WARNING("failed to fetch updates from response from the server, likely corrupt data");
         return;
     }
 
     work_any_updates(DS_U, context);
-    free_ds_type_updates(DS_U, &type);
 }
 
 void updater::work_encrypted_message(const tl_ds_encrypted_message* DS_EM, const update_context&)
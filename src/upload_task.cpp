@@ -21,6 +21,8 @@
 
 #include "upload_task.h"
 
+#include "crypto/crypto_mem.h"
+#include "file_io.h"
 #include "tgl/tgl_message.h"
 
 #include <cstring>
@@ -32,6 +34,7 @@ upload_task::upload_task()
     : size(0)
     , uploaded_bytes(0)
     , part_num(0)
+    , part_size(0)
     , id(0)
     , thumb_id(0)
     , to_id()
@@ -40,6 +43,9 @@ upload_task::upload_task()
     , animated(false)
     , avatar(0)
     , reply(0)
+    , read_time(0)
+    , crypto_time(0)
+    , send_time(0)
     , width(0)
     , height(0)
     , duration(0)
@@ -47,6 +53,10 @@ upload_task::upload_task()
     , thumb_height(0)
     , message_id(0)
     , status(tgl_upload_status::waiting)
+    , throttled_parts(0)
+    , encrypting(false)
+    , encrypted_parts(0)
+    , resumable(false)
     , m_cancel_requested(false)
 {
 }
@@ -54,9 +64,12 @@ upload_task::upload_task()
 upload_task::~upload_task()
 {
     // For security reasion.
-    memset(iv.data(), 0, iv.size());
-    memset(init_iv.data(), 0, init_iv.size());
-    memset(key.data(), 0, key.size());
+    TGLC_cleanse(iv.data(), iv.size());
+    TGLC_cleanse(init_iv.data(), init_iv.size());
+    TGLC_cleanse(key.data(), key.size());
+    for (auto& it: part_ivs) {
+        TGLC_cleanse(it.second.data(), it.second.size());
+    }
 }
 
 void upload_task::set_status(tgl_upload_status status, const std::shared_ptr<tgl_message>& message)
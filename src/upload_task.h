@@ -21,11 +21,15 @@
 
 #pragma once
 
+#include "rate_limiter.h"
 #include "tgl/tgl_peer_id.h"
 #include "tgl/tgl_transfer_manager.h"
 
 #include <array>
 #include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -35,13 +39,17 @@ class tgl_message;
 namespace tgl {
 namespace impl {
 
+class mapped_file;
 class query_upload_file_part;
+struct TGLC_aes_key;
+struct upload_part_encryption;
 
 class upload_task {
 public:
     uintmax_t size;
     uintmax_t uploaded_bytes;
     size_t part_num;
+    size_t part_size;
     int64_t id;
     int64_t thumb_id;
     tgl_input_peer_t to_id;
@@ -54,6 +62,11 @@ public:
     std::array<unsigned char, 32> iv;
     std::array<unsigned char, 32> init_iv;
     std::array<unsigned char, 32> key;
+    std::shared_ptr<const TGLC_aes_key> aes_key; // expanded from key once per upload
+    // Seconds spent in each stage of the upload, summed over the parts.
+    double read_time;
+    double crypto_time;
+    double send_time;
     int32_t width;
     int32_t height;
     int32_t duration;
@@ -67,14 +80,32 @@ public:
 
     tgl_upload_status status;
 
+    // Parts between being read and being acknowledged. Their number bounds
+    // how many parts can wait in each stage of the upload.
     std::unordered_set<size_t> running_parts;
+    transfer_share share;
+    size_t throttled_parts; // held back by the rate limits, sent once they allow it
+    std::map<size_t, double> part_send_times;
+    // Every part of an encrypted file continues the IV of the one before,
+    // so parts wait here while an earlier one is encrypted on a crypto worker.
+    std::deque<std::shared_ptr<upload_part_encryption>> parts_to_encrypt;
+    bool encrypting;
+    size_t encrypted_parts;
+    // The IV each encrypted part which hasn't been acknowledged yet started
+    // with, for the upload state to continue from.
+    std::map<size_t, std::array<unsigned char, 32>> part_ivs;
+    std::vector<bool> acknowledged_parts; // only kept for resumable uploads
     tgl_upload_callback callback;
     tgl_read_callback read_callback;
+    tgl_read_at_callback read_at_callback;
+    std::shared_ptr<const mapped_file> source; // used instead of the read callbacks if there are none
+    bool resumable;
     tgl_upload_part_done_callback part_done_callback;
 
     upload_task();
     ~upload_task();
 
+    bool is_resumable() const { return resumable; }
     bool is_encrypted() const { return to_id.peer_type == tgl_peer_type::enc_chat; }
     bool is_animated() const { return animated; }
     bool is_image() const { return doc_type == tgl_document_type::image; }
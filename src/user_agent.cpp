@@ -34,11 +34,15 @@
 #include "crypto/crypto_rand.h"
 #include "crypto/crypto_rsa_pem.h"
 #include "crypto/crypto_sha.h"
+#include "crypto_executor.h"
+#include "frame_buffer_pool.h"
+#include "inflater.h"
 #include "login_context.h"
 #include "message.h"
 #include "mtproto_client.h"
 #include "mtproto_common.h"
 #include "mtproto_utils.h"
+#include "peer_cache.h"
 #include "query/query_add_contacts.h"
 #include "query/query_block_or_unblock_user.h"
 #include "query/query_channel_get_participant.h"
@@ -103,6 +107,7 @@
 #include "tgl/tgl_secure_random.h"
 #include "tgl/tgl_timer.h"
 #include "tgl/tgl_unconfirmed_secret_message_storage.h"
+#include "tgl/tgl_upload_state_storage.h"
 #include "tgl/tgl_update_callback.h"
 #include "tgl/tgl_value.h"
 #include "tools.h"
@@ -113,11 +118,18 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <limits>
 #include <string>
 
 constexpr int MAX_DC_ID = 10;
 constexpr int32_t TG_APP_ID = 10534;
 constexpr const char* TG_APP_HASH = "844584f2b1fd2daecee726166dcc1ef8";
+constexpr size_t DEFAULT_MAX_MESSAGE_BATCH_SIZE = 32 * 1024;
+constexpr size_t MAX_MESSAGE_BATCH_SIZE = 1024 * 1024;
+constexpr size_t MAX_CRYPTO_THREADS = 8;
+constexpr size_t DEFAULT_MEDIA_CONNECTIONS = 3;
+constexpr size_t MAX_MEDIA_CONNECTIONS = 16;
+constexpr double DEFAULT_REQUEST_RESULT_TTL = 2;
 
 std::shared_ptr<tgl_user_agent> tgl_user_agent::create(
         const std::vector<std::string>& rsa_keys,
@@ -171,6 +183,12 @@ std::shared_ptr<tgl_user_agent> tgl_user_agent::create(
 namespace tgl {
 namespace impl {
 
+static std::string request_key(const query& q)
+{
+    const auto& s = q.serializer();
+    return std::string(reinterpret_cast<const char*>(s->i32_data()), s->i32_size() * 4);
+}
+
 user_agent::user_agent()
     : m_online_status(tgl_online_status::not_online)
     , m_date(0)
@@ -181,6 +199,12 @@ user_agent::user_agent()
     , m_temp_key_expire_time(0)
     , m_bytes_sent(0)
     , m_bytes_received(0)
+    , m_frames_received(0)
+    , m_frame_bytes_copied(0)
+    , m_max_message_batch_size(DEFAULT_MAX_MESSAGE_BATCH_SIZE)
+    , m_max_message_batch_delay(0)
+    , m_crypto_offload_min_size(std::numeric_limits<size_t>::max())
+    , m_media_connections(DEFAULT_MEDIA_CONNECTIONS)
     , m_is_started(false)
     , m_test_mode(false)
     , m_pfs_enabled(false)
@@ -191,7 +215,11 @@ user_agent::user_agent()
     , m_device_token_type(0)
     , m_bn_ctx(std::make_unique<tgl_bn_context>(TGLC_bn_ctx_new()))
     , m_updater(std::make_unique<class updater>(*this))
+    , m_inflater(std::make_unique<class inflater>())
+    , m_frame_buffer_pool(std::make_unique<class frame_buffer_pool>())
+    , m_peer_cache(std::make_unique<class peer_cache>())
 {
+    set_request_coalescing(DEFAULT_REQUEST_RESULT_TTL);
 }
 
 void user_agent::shut_down()
@@ -201,6 +229,12 @@ void user_agent::shut_down()
     m_online_status_observers.clear();
     m_clients.clear();
     m_active_queries.clear();
+    for (auto& stats: m_query_stats) {
+        stats.in_flight = 0;
+    }
+    m_info_requests.clear();
+    m_user_info_requests.clear();
+    m_peer_cache->clear();
     m_retry_queries.clear();
     m_secret_chats.clear();
 }
@@ -447,6 +481,7 @@ void user_agent::add_active_query(const std::shared_ptr<query>& q)
     auto inserted_iterator_pair = m_active_queries.emplace(id, q);
     if (inserted_iterator_pair.second) {
         q->client()->increase_active_queries();
+        m_query_stats[static_cast<size_t>(q->query_class())].in_flight++;
     } else {
         inserted_iterator_pair.first->second = q;
     }
@@ -470,9 +505,26 @@ void user_agent::remove_active_query(const std::shared_ptr<query>& q)
     if (it != m_active_queries.end()) {
         m_active_queries.erase(it);
         q->client()->decrease_active_queries();
+
+        tgl_query_stats& stats = m_query_stats[static_cast<size_t>(q->query_class())];
+        if (stats.in_flight) {
+            stats.in_flight--;
+        }
     }
 }
 
+void user_agent::query_finished(const query& q, bool success)
+{
+    double seconds = tgl_get_monotonic_time() - q.execute_time();
+    uint64_t microseconds = seconds > 0 ? static_cast<uint64_t>(seconds * 1000000) : 0;
+
+    tgl_query_stats& stats = m_query_stats[static_cast<size_t>(q.query_class())];
+    stats.completed++;
+    stats.latency.record(microseconds);
+
+    m_query_metrics.query_finished(q, success, microseconds);
+}
+
 void user_agent::add_retry_query(const std::shared_ptr<query>& q)
 {
     m_retry_queries.insert(q);
@@ -515,6 +567,52 @@ void user_agent::state_lookup_timeout()
     }
 }
 
+void user_agent::set_message_batching(size_t max_batch_size, double max_batch_delay)
+{
+    m_max_message_batch_size = std::min(max_batch_size, MAX_MESSAGE_BATCH_SIZE);
+    m_max_message_batch_delay = std::max(max_batch_delay, 0.0);
+}
+
+void user_agent::set_crypto_offload(size_t thread_count, size_t min_size)
+{
+    if (!thread_count) {
+        m_crypto_offload_min_size = std::numeric_limits<size_t>::max();
+        return;
+    }
+
+    if (!m_crypto_executor) {
+        if (!m_timer_factory) {
+            TGL_ERROR("the timer factory has to be set before enabling crypto offload");
+            return;
+        }
+        m_crypto_executor = std::make_unique<crypto_worker_pool>(m_timer_factory, std::min(thread_count, MAX_CRYPTO_THREADS));
+    }
+    m_crypto_offload_min_size = min_size;
+}
+
+void user_agent::set_media_connections(size_t count)
+{
+    m_media_connections = std::min(count, MAX_MEDIA_CONNECTIONS);
+}
+
+void user_agent::set_request_coalescing(double result_ttl)
+{
+    m_info_requests.set_result_ttl(result_ttl);
+    m_user_info_requests.set_result_ttl(result_ttl);
+    if (result_ttl <= 0) {
+        m_info_requests.clear_results();
+        m_user_info_requests.clear_results();
+    }
+}
+
+class crypto_executor* user_agent::crypto_executor(size_t size) const
+{
+    if (size < m_crypto_offload_min_size) {
+        return nullptr;
+    }
+    return m_crypto_executor.get();
+}
+
 void user_agent::set_online_status(tgl_online_status status)
 {
     if (status == m_online_status) {
@@ -577,6 +675,11 @@ user_agent::unconfirmed_secret_message_storage() const
     return m_unconfirmed_secret_message_storage;
 }
 
+void user_agent::set_upload_state_storage(const std::shared_ptr<tgl_upload_state_storage>& storage)
+{
+    m_upload_state_storage = storage;
+}
+
 void user_agent::clear_all_locks()
 {
     m_diff_locked = false;
@@ -830,10 +933,16 @@ void user_agent::search_contact(const std::string& name, int limit,
 
 void user_agent::resolve_username(const std::string& name, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_resolve_username>(*this, callback);
+    auto key = std::make_shared<std::string>();
+    auto q = std::make_shared<query_resolve_username>(*this, [this, key](bool success) {
+        m_info_requests.finish(*key, tgl_get_monotonic_time(), success);
+    });
     q->out_i32(CODE_contacts_resolve_username);
     q->out_std_string(name);
-    q->execute(active_client());
+    *key = request_key(*q);
+    if (m_info_requests.add(*key, callback, tgl_get_monotonic_time())) {
+        q->execute(active_client());
+    }
 }
 
 void user_agent::forward_messages(const tgl_input_peer_t& from_id, const tgl_input_peer_t& to_id,
@@ -1176,22 +1285,34 @@ void user_agent::get_channel_participant_self(const tgl_input_peer_t& channel_id
 
 void user_agent::get_chat_info(int32_t id, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_get_chat_info>(*this, callback);
+    auto key = std::make_shared<std::string>();
+    auto q = std::make_shared<query_get_chat_info>(*this, [this, key](bool success) {
+        m_info_requests.finish(*key, tgl_get_monotonic_time(), success);
+    });
     q->out_i32(CODE_messages_get_full_chat);
     q->out_i32(id);
-    q->execute(active_client());
+    *key = request_key(*q);
+    if (m_info_requests.add(*key, callback, tgl_get_monotonic_time())) {
+        q->execute(active_client());
+    }
 }
 
 void user_agent::get_channel_info(const tgl_input_peer_t& id,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_get_channel_info>(*this, callback);
+    auto key = std::make_shared<std::string>();
+    auto q = std::make_shared<query_get_channel_info>(*this, [this, key](bool success) {
+        m_info_requests.finish(*key, tgl_get_monotonic_time(), success);
+    });
     q->out_i32(CODE_channels_get_full_channel);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
     q->out_i32(id.peer_id);
     q->out_i64(id.access_hash);
-    q->execute(active_client());
+    *key = request_key(*q);
+    if (m_info_requests.add(*key, callback, tgl_get_monotonic_time())) {
+        q->execute(active_client());
+    }
 }
 
 void user_agent::get_user_info(const tgl_input_peer_t& id, const std::function<void(bool success, const std::shared_ptr<tgl_user>& user)>& callback)
@@ -1204,13 +1325,19 @@ void user_agent::get_user_info(const tgl_input_peer_t& id, const std::function<v
         return;
     }
 
-    auto q = std::make_shared<query_user_info>(*this, callback);
+    auto key = std::make_shared<std::string>();
+    auto q = std::make_shared<query_user_info>(*this, [this, key](bool success, const std::shared_ptr<user>& u) {
+        m_user_info_requests.finish(*key, tgl_get_monotonic_time(), success, u);
+    });
     q->out_i32(CODE_users_get_full_user);
     assert(id.peer_type == tgl_peer_type::user);
     q->out_i32(CODE_input_user);
     q->out_i32(id.peer_id);
     q->out_i64(id.access_hash);
-    q->execute(active_client());
+    *key = request_key(*q);
+    if (m_user_info_requests.add(*key, callback, tgl_get_monotonic_time())) {
+        q->execute(active_client());
+    }
 }
 
 void user_agent::add_contacts(const std::vector<std::tuple<std::string, std::string, std::string>>& contacts, bool replace,
@@ -2448,41 +2575,113 @@ void user_agent::bytes_received(size_t bytes)
     m_bytes_received += bytes;
 }
 
+void user_agent::frame_received(size_t bytes_copied)
+{
+    m_frames_received++;
+    m_frame_bytes_copied += bytes_copied;
+}
+
 tgl_net_stats user_agent::get_net_stats(bool reset_after_get)
 {
     tgl_net_stats stats;
     stats.bytes_sent = m_bytes_sent;
     stats.bytes_received = m_bytes_received;
+    stats.peak_inflate_buffer_size = m_inflater->peak_buffer_size();
+    stats.frames_received = m_frames_received;
+    stats.frame_bytes_copied = m_frame_bytes_copied;
     if (reset_after_get) {
         m_bytes_sent = 0;
         m_bytes_received = 0;
+        m_frames_received = 0;
+        m_frame_bytes_copied = 0;
+        m_inflater->reset_peak_buffer_size();
     }
     return stats;
 }
 
+tgl_query_stats user_agent::get_query_stats(tgl_query_class query_class, bool reset_after_get)
+{
+    tgl_query_stats& stats = m_query_stats[static_cast<size_t>(query_class)];
+    tgl_query_stats result = stats;
+    if (reset_after_get) {
+        stats.completed = 0;
+        stats.latency = tgl_latency_histogram();
+    }
+    return result;
+}
+
+tgl_request_cache_stats user_agent::get_request_cache_stats(bool reset_after_get)
+{
+    tgl_request_cache_stats stats;
+    stats.coalesced = m_info_requests.coalesced() + m_user_info_requests.coalesced();
+    stats.cache_hits = m_info_requests.cache_hits() + m_user_info_requests.cache_hits();
+    stats.misses = m_info_requests.misses() + m_user_info_requests.misses();
+    if (reset_after_get) {
+        m_info_requests.reset_counters();
+        m_user_info_requests.reset_counters();
+    }
+    return stats;
+}
+
+tgl_query_metrics user_agent::get_query_metrics(bool reset_after_get)
+{
+    tgl_query_metrics metrics = m_query_metrics.snapshot(reset_after_get);
+    metrics.active_queries = m_active_queries.size();
+    for (const auto& client: m_clients) {
+        if (client) {
+            metrics.pending_queries += client->pending_queries();
+        }
+    }
+    metrics.retrying_queries = m_retry_queries.size();
+    return metrics;
+}
+
 void user_agent::user_fetched(const std::shared_ptr<user>& u)
 {
     if (u->is_self()) {
         set_our_id(u->id().peer_id);
     }
 
+    uint32_t changes = m_peer_cache->update(*u);
     if (u->is_deleted()) {
-        m_callback->user_deleted(u->id().peer_id);
-    } else {
+        if (changes & peer_cache::details_changed) {
+            m_callback->user_deleted(u->id().peer_id);
+        }
+        return;
+    }
+
+    if (changes & peer_cache::details_changed) {
         m_callback->new_user(u);
+    }
+    if (changes & peer_cache::photo_changed) {
         m_callback->avatar_update(u->id().peer_id, u->id().peer_type, u->photo_small(), u->photo_big());
     }
 }
 
 void user_agent::chat_fetched(const std::shared_ptr<chat>& c)
 {
-    if (c->is_channel()) {
-        m_callback->channel_update(std::static_pointer_cast<channel>(c));
-    } else {
-        m_callback->chat_update(c);
+    uint32_t changes = m_peer_cache->update(*c);
+    if (changes & peer_cache::details_changed) {
+        if (c->is_channel()) {
+            m_callback->channel_update(std::static_pointer_cast<channel>(c));
+        } else {
+            m_callback->chat_update(c);
+        }
     }
 
-    m_callback->avatar_update(c->id().peer_id, c->id().peer_type, c->photo_small(), c->photo_big());
+    if (changes & peer_cache::photo_changed) {
+        m_callback->avatar_update(c->id().peer_id, c->id().peer_type, c->photo_small(), c->photo_big());
+    }
+}
+
+void user_agent::peer_updated(const tgl_peer_id_t& id)
+{
+    m_peer_cache->invalidate(id);
+}
+
+int64_t user_agent::peer_access_hash(const tgl_peer_id_t& id) const
+{
+    return m_peer_cache->access_hash(id);
 }
 
 }
@@ -21,6 +21,8 @@
 #pragma once
 
 #include "chat.h"
+#include "query_metrics.h"
+#include "request_coalescer.h"
 #include "tgl/tgl_connection_status.h"
 #include "tgl/tgl_online_status.h"
 #include "tgl/tgl_peer_id.h"
@@ -50,6 +52,9 @@ struct tgl_bn_context;
 
 class channel;
 class chat;
+class crypto_executor;
+class frame_buffer_pool;
+class inflater;
 class message;
 class mtproto_client;
 class query;
@@ -98,6 +103,10 @@ public:
     virtual bool test_mode() const override { return m_test_mode; }
     virtual void set_pfs_enabled(bool b) override { m_pfs_enabled = b; }
     virtual void set_ipv6_enabled(bool b) override { m_ipv6_enabled = b; }
+    virtual void set_message_batching(size_t max_batch_size, double max_batch_delay) override;
+    virtual void set_crypto_offload(size_t thread_count, size_t min_size) override;
+    virtual void set_media_connections(size_t count) override;
+    virtual void set_request_coalescing(double result_ttl) override;
 
     virtual void reset_authorization() override;
     virtual void add_rsa_key(const std::string& key) override;
@@ -115,6 +124,7 @@ public:
 
     virtual tgl_transfer_manager* transfer_manager() const override { return m_transfer_manager.get(); }
     virtual void set_unconfirmed_secret_message_storage(const std::shared_ptr<tgl_unconfirmed_secret_message_storage>& storage) override;
+    virtual void set_upload_state_storage(const std::shared_ptr<tgl_upload_state_storage>& storage) override;
     virtual int32_t create_secret_chat_id() const override;
 
     virtual std::shared_ptr<tgl_secret_chat> load_secret_chat(int32_t chat_id, int64_t access_hash, int32_t user_id,
@@ -131,6 +141,9 @@ public:
             const unsigned char* exchange_key) override;
 
     virtual tgl_net_stats get_net_stats(bool reset_after_get = true) override;
+    virtual tgl_query_stats get_query_stats(tgl_query_class query_class, bool reset_after_get = true) override;
+    virtual tgl_request_cache_stats get_request_cache_stats(bool reset_after_get = true) override;
+    virtual tgl_query_metrics get_query_metrics(bool reset_after_get = true) override;
     // == tgl_user_agent ==
 
     // == tgl_query_api ==
@@ -269,16 +282,26 @@ public:
 
     bool pfs_enabled() const { return m_pfs_enabled; }
     bool ipv6_enabled() const { return m_ipv6_enabled; }
+    size_t max_message_batch_size() const { return m_max_message_batch_size; }
+    double max_message_batch_delay() const { return m_max_message_batch_delay; }
+    size_t media_connections() const { return m_media_connections; }
+    class query_metrics& query_metrics() { return m_query_metrics; }
 
     const std::shared_ptr<tgl_update_callback>& callback() const { return m_callback; }
     const std::shared_ptr<tgl_connection_factory>& connection_factory() const { return m_connection_factory; }
     const std::shared_ptr<tgl_timer_factory>& timer_factory() const { return m_timer_factory; }
     const std::shared_ptr<tgl_unconfirmed_secret_message_storage> unconfirmed_secret_message_storage() const;
+    const std::shared_ptr<tgl_upload_state_storage>& upload_state_storage() const { return m_upload_state_storage; }
 
     bool is_started() const { return m_is_started; }
     void set_started(bool b) { m_is_started = b; }
 
     class updater& updater() const { return *m_updater; }
+    class inflater& inflater() const { return *m_inflater; }
+    class frame_buffer_pool& frame_buffer_pool() const { return *m_frame_buffer_pool; }
+    // The executor to encrypt or decrypt size bytes on, or nullptr if it
+    // should be done right away on this thread.
+    class crypto_executor* crypto_executor(size_t size) const;
 
     const std::vector<std::shared_ptr<mtproto_client>>& clients() const { return m_clients; }
     std::shared_ptr<mtproto_client> active_client() const { return m_active_client; }
@@ -301,6 +324,9 @@ public:
     void add_active_query(const std::shared_ptr<query>& q);
     std::shared_ptr<query> get_active_query(int64_t id) const;
     void remove_active_query(const std::shared_ptr<query>& q);
+    // Once per query, when it is answered or has failed for good. Resends
+    // only take a query out of the active ones.
+    void query_finished(const query& q, bool success);
 
     void add_retry_query(const std::shared_ptr<query>& q);
     void remove_retry_query(const std::shared_ptr<query>& q);
@@ -321,9 +347,15 @@ public:
 
     void bytes_sent(size_t bytes);
     void bytes_received(size_t bytes);
+    void frame_received(size_t bytes_copied);
 
     void user_fetched(const std::shared_ptr<user>& u);
     void chat_fetched(const std::shared_ptr<chat>& c);
+    // For updates which tell the client about a peer without going through
+    // user_fetched() or chat_fetched().
+    void peer_updated(const tgl_peer_id_t& id);
+    // 0 if the peer hasn't been seen yet.
+    int64_t peer_access_hash(const tgl_peer_id_t& id) const;
 
 private:
     void state_lookup_timeout();
@@ -362,6 +394,17 @@ private:
 
     uint64_t m_bytes_sent;
     uint64_t m_bytes_received;
+    uint64_t m_frames_received;
+    uint64_t m_frame_bytes_copied;
+    std::array<tgl_query_stats, 3> m_query_stats; // by tgl_query_class
+    class query_metrics m_query_metrics;
+    request_coalescer<bool> m_info_requests;
+    request_coalescer<bool, std::shared_ptr<tgl_user>> m_user_info_requests;
+
+    size_t m_max_message_batch_size;
+    double m_max_message_batch_delay;
+    size_t m_crypto_offload_min_size;
+    size_t m_media_connections;
 
     bool m_is_started;
     bool m_test_mode;
@@ -385,11 +428,18 @@ private:
     std::shared_ptr<tgl_connection_factory> m_connection_factory;
     std::shared_ptr<tgl_update_callback> m_callback;
     std::shared_ptr<tgl_unconfirmed_secret_message_storage> m_unconfirmed_secret_message_storage;
+    std::shared_ptr<tgl_upload_state_storage> m_upload_state_storage;
     std::shared_ptr<mtproto_client> m_active_client;
     std::shared_ptr<tgl_timer> m_state_lookup_timer;
 
     std::unique_ptr<tgl_bn_context> m_bn_ctx;
     std::unique_ptr<class updater> m_updater;
+    std::unique_ptr<class inflater> m_inflater;
+    std::unique_ptr<class frame_buffer_pool> m_frame_buffer_pool;
+    std::unique_ptr<class peer_cache> m_peer_cache;
+    // Declared after the buffer pools since jobs still queued on it when it
+    // goes away may hold buffers from them.
+    std::unique_ptr<class crypto_executor> m_crypto_executor;
 
     std::vector<std::shared_ptr<mtproto_client>> m_clients;
     std::vector<std::shared_ptr<rsa_public_key>> m_rsa_keys;
@@ -0,0 +1,203 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "rate_limiter.h"
+#include "tgl/tgl_timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace tgl::impl;
+
+static int failures = 0;
+
+#define CHECK_NEAR(value, expected, tolerance) \
+    do { \
+        double v = (value); \
+        double e = (expected); \
+        if (std::fabs(v - e) > (tolerance)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #value " is " << v << ", expected " << e \
+                    << " +- " << (tolerance) << std::endl; \
+            ++failures; \
+        } \
+    } while (false)
+
+// Time only moves when the test advances it, firing the timers which are due
+// in order.
+class fake_timer_factory: public tgl_timer_factory
+{
+public:
+    class fake_timer: public tgl_timer
+    {
+    public:
+        fake_timer(fake_timer_factory& factory, const std::function<void()>& cb)
+            : m_factory(factory), m_cb(cb), m_due(-1)
+        { }
+
+        virtual void start(double seconds_from_now) override { m_due = m_factory.m_now + seconds_from_now; }
+        virtual void cancel() override { m_due = -1; }
+
+        fake_timer_factory& m_factory;
+        std::function<void()> m_cb;
+        double m_due;
+    };
+
+    fake_timer_factory() : m_now(1000) { }
+
+    virtual std::shared_ptr<tgl_timer> create_timer(const std::function<void()>& cb) override
+    {
+        auto timer = std::make_shared<fake_timer>(*this, cb);
+        m_timers.push_back(timer);
+        return timer;
+    }
+
+    virtual double monotonic_time() const override { return m_now; }
+
+    void run_until(double until)
+    {
+        while (true) {
+            std::shared_ptr<fake_timer> next;
+            for (const auto& weak_timer: m_timers) {
+                auto timer = weak_timer.lock();
+                if (timer && timer->m_due >= 0 && timer->m_due <= until && (!next || timer->m_due < next->m_due)) {
+                    next = timer;
+                }
+            }
+            if (!next) {
+                break;
+            }
+            m_now = std::max(m_now, next->m_due);
+            next->m_due = -1;
+            next->m_cb();
+        }
+        m_now = until;
+    }
+
+    double m_now;
+    std::vector<std::weak_ptr<fake_timer>> m_timers;
+};
+
+static const size_t PART_SIZE = 1000;
+
+// A transfer which always has another part to send.
+struct fake_transfer
+{
+    transfer_share share;
+    uint64_t sent = 0;
+
+    void send(transfer_scheduler& scheduler)
+    {
+        while (scheduler.admit(share, PART_SIZE, [this, &scheduler] { send(scheduler); })) {
+            sent += PART_SIZE;
+        }
+    }
+};
+
+static void test_token_bucket()
+{
+    token_bucket bucket;
+    double now = 0;
+    bucket.set_rate(100000, now);
+
+    uint64_t sent = 0;
+    while (now < 10) {
+        double wait = bucket.wait_time(now);
+        if (wait) {
+            now += wait;
+            continue;
+        }
+        bucket.consume(PART_SIZE, now);
+        sent += PART_SIZE;
+    }
+    // The first part goes out at once, every later one when the debt is paid.
+    CHECK_NEAR(sent, 100000 * 10 + PART_SIZE, PART_SIZE);
+
+    // Refunded bytes can be sent again right away.
+    bucket.consume(PART_SIZE * 10, now);
+    CHECK_NEAR(bucket.wait_time(now), 0.1, 1e-9);
+    bucket.refund(PART_SIZE * 10, now);
+    CHECK_NEAR(bucket.wait_time(now), 0, 1e-9);
+}
+
+static void test_rate_limit()
+{
+    auto factory = std::make_shared<fake_timer_factory>();
+    transfer_scheduler scheduler([factory] { return factory; });
+    scheduler.set_rate_limit(100000);
+
+    fake_transfer transfer;
+    transfer.send(scheduler);
+    factory->run_until(factory->m_now + 10);
+    CHECK_NEAR(transfer.sent, 100000 * 10, 2 * PART_SIZE);
+}
+
+static void test_fair_share()
+{
+    auto factory = std::make_shared<fake_timer_factory>();
+    transfer_scheduler scheduler([factory] { return factory; });
+    scheduler.set_rate_limit(100000);
+
+    fake_transfer light;
+    fake_transfer heavy;
+    scheduler.set_share(heavy.share, 0, 3);
+    light.send(scheduler);
+    heavy.send(scheduler);
+    factory->run_until(factory->m_now + 10);
+
+    CHECK_NEAR(light.sent + heavy.sent, 100000 * 10, 2 * PART_SIZE);
+    CHECK_NEAR(light.sent, 100000 * 10 / 4, 2 * PART_SIZE);
+    CHECK_NEAR(heavy.sent, 100000 * 10 * 3 / 4, 2 * PART_SIZE);
+}
+
+static void test_transfer_limit()
+{
+    auto factory = std::make_shared<fake_timer_factory>();
+    transfer_scheduler scheduler([factory] { return factory; });
+    scheduler.set_rate_limit(100000);
+
+    fake_transfer capped;
+    fake_transfer other;
+    scheduler.set_share(capped.share, 20000, 1);
+    capped.send(scheduler);
+    other.send(scheduler);
+    factory->run_until(factory->m_now + 10);
+
+    // What the capped transfer can't use goes to the other one.
+    CHECK_NEAR(capped.sent, 20000 * 10, 2 * PART_SIZE);
+    CHECK_NEAR(other.sent, 80000 * 10, 2 * PART_SIZE);
+}
+
+int main()
+{
+    test_token_bucket();
+    test_rate_limit();
+    test_fair_share();
+    test_transfer_limit();
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}